@@ -0,0 +1,278 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../src/charstats.h"
+#include "../src/histogram.h"
+#include "../src/strutils.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#define USAGE "Usage: %s [-s size_MB] [-k skew] [-r repetitions] [-j threads] [-c corpus]\n"
+
+#define DEFAULT_SIZE_MB 64
+#define DEFAULT_SKEW 1.0
+#define DEFAULT_REPS 3
+// Share of the corpus that is not letters (spaces, punctuation, newlines)
+#define NON_LETTER_RATIO 0.2
+// Seed of the corpus generator, fixed so corpora are reproducible
+#define CORPUS_SEED 0x5eed
+
+
+// A counting backend, creating a CharStats object from a path
+typedef struct backend {
+    const char *name;
+    const char *kernel; // Histogram kernel to force, or NULL for the default
+    CharStats *(*count)(char *path, int nthreads);
+} Backend;
+
+static CharStats *count_fgetc(char *path, int nthreads);
+static CharStats *count_block(char *path, int nthreads);
+static CharStats *count_mmap(char *path, int nthreads);
+static CharStats *count_parallel(char *path, int nthreads);
+
+static const Backend backends[] = {
+    { "fgetc",    NULL,     count_fgetc },
+    { "block",    NULL,     count_block },
+    { "mmap",     "scalar", count_mmap },
+    { "mmap",     "sse2",   count_mmap },
+    { "mmap",     "avx2",   count_mmap },
+    { "parallel", NULL,     count_parallel },
+};
+#define BACKENDS_N (sizeof(backends) / sizeof(backends[0]))
+
+static int generate_corpus(char *path, long long size, double skew);
+static void drop_cache(char *path);
+static void warm_cache(char *path);
+static double now(void);
+static unsigned long long cycles(void);
+
+
+int main(int argc, char **argv)
+{
+    long long size = DEFAULT_SIZE_MB * 1024LL*1024;
+    double skew = DEFAULT_SKEW;
+    int reps = DEFAULT_REPS;
+    int nthreads = 0;
+    char *corpus = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:k:r:j:c:")) != -1) {
+        switch (opt) {
+        case 's':  size = atof(optarg) * 1024*1024;  break;
+        case 'k':  skew = atof(optarg);  break;
+        case 'r':  reps = atoi(optarg);  break;
+        case 'j':  nthreads = atoi(optarg);  break;
+        case 'c':  corpus = optarg;  break;
+        default:
+            fprintf(stderr, USAGE, argv[0]);
+            return 1;
+        }
+    }
+    if (size <= 0 || reps <= 0) {
+        fprintf(stderr, USAGE, argv[0]);
+        return 1;
+    }
+
+    // Generate the corpus, unless an existing one was given
+    char tmppath[] = "/tmp/cstats_bench_XXXXXX";
+    if (corpus == NULL) {
+        int fd = mkstemp(tmppath);
+        if (fd == -1) {
+            fprintf(stderr, "Error creating the corpus file\n");
+            return 1;
+        }
+        close(fd);
+        if (generate_corpus(tmppath, size, skew))  return 1;
+    }
+    char *path = corpus != NULL ? corpus : tmppath;
+
+    // Reference counts, to check every backend against
+    CharStats *ref = count_block(path, 1);
+    if (ref == NULL)  return 1;
+    size = ref->nbytes;
+
+    const char *default_kernel = hist_kernel_name();
+    int status = 0;
+    printf("backend,kernel,threads,cache,rep,bytes,seconds,mb_per_s,cycles_per_byte\n");
+    for (size_t b = 0; b < BACKENDS_N; b++) {
+        const Backend *be = &backends[b];
+        if (be->kernel != NULL && hist_select(be->kernel))  continue; // Not supported here
+        if (be->kernel == NULL)  hist_select(default_kernel);
+
+        for (int cold = 1; cold >= 0; cold--) {
+            for (int r = 0; r < reps; r++) {
+                if (cold)  drop_cache(path);
+                else  warm_cache(path);
+
+                double t0 = now();
+                unsigned long long c0 = cycles();
+                CharStats *stats = be->count(path, nthreads);
+                unsigned long long c1 = cycles();
+                double t1 = now();
+
+                if (stats == NULL) {
+                    fprintf(stderr, "Backend '%s' couldn't read '%s'\n", be->name, path);
+                    status = 1;
+                    continue;
+                }
+                if (memcmp(stats->counts, ref->counts, ASCII_N * sizeof(int)) != 0) {
+                    fprintf(stderr, "Backend '%s' gave different counts\n", be->name);
+                    status = 1;
+                }
+                stats->free(stats);
+
+                double secs = t1 - t0;
+                const char *kernel = be->kernel != NULL ? be->kernel : default_kernel;
+                printf("%s,%s,%d,%s,%d,%lld,%.6f,%.1f,", be->name,
+                       be->count == count_fgetc ? "none" : kernel,
+                       be->count == count_parallel ? cstats_count_threads(size, nthreads) : 1,
+                       cold ? "cold" : "warm", r, size, secs, size / secs / 1e6);
+                if (c1 > c0)  printf("%.3f\n", (double) (c1 - c0) / size);
+                else  printf("\n"); // No cycle counter
+            }
+        }
+    }
+
+    ref->free(ref);
+    if (corpus == NULL)  unlink(tmppath);
+    return status;
+}
+
+
+/** @brief Counts with `cstats_init_fp_bytewise` (one `fgetc` per byte). */
+static CharStats *count_fgetc(char *path, int nthreads)
+{
+    (void) nthreads;
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)  return NULL;
+    CharStats *stats = cstats_init_fp_bytewise(fp, 0);
+    fclose(fp);
+    return stats;
+}
+/** @brief Counts with `cstats_init_fp` (block reads). */
+static CharStats *count_block(char *path, int nthreads)
+{
+    (void) nthreads;
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)  return NULL;
+    CharStats *stats = cstats_init_fp(fp, 0);
+    fclose(fp);
+    return stats;
+}
+/** @brief Counts with `cstats_init_mmap`. */
+static CharStats *count_mmap(char *path, int nthreads)
+{
+    (void) nthreads;
+    return cstats_init_mmap(path, 0);
+}
+/** @brief Counts with `cstats_init_path_mt`. */
+static CharStats *count_parallel(char *path, int nthreads)
+{
+    return cstats_init_path_mt(path, 0, nthreads);
+}
+
+
+/** @brief Writes a synthetic corpus with a Zipf-like letter distribution.
+ *
+ * Letters are drawn with probability proportional to 1/rank^`skew`, so a skew
+ * of 0 gives uniform letters and higher skews concentrate on the first
+ * letters of a fixed, Spanish-like frequency order. A share of the bytes are
+ * spaces, punctuation and newlines, and a quarter of the letters are
+ * uppercase. The same size and skew always give the same corpus.
+ *
+ * @param path Path of the file to write.
+ * @param size Size of the corpus in bytes.
+ * @param skew Zipf exponent of the letter distribution.
+ * @return 0 on success, 1 if the file couldn't be written.
+ */
+static int generate_corpus(char *path, long long size, double skew)
+{
+    static const char order[ALPHABET_N+1] = "EAOSNRILDUTCMPBGVYQHFZJXKW";
+    static const char others[] = "     \n,.;";
+
+    // Cumulative distribution of the letters, scaled to 32 bits
+    double weights[ALPHABET_N], total = 0;
+    for (int i = 0; i < ALPHABET_N; i++)  total += weights[i] = 1.0 / pow(i + 1, skew);
+    unsigned int cdf[ALPHABET_N];
+    double acc = 0;
+    for (int i = 0; i < ALPHABET_N; i++) {
+        acc += weights[i] / total;
+        cdf[i] = acc >= 1.0 ? 0xFFFFFFFFu : (unsigned int) (acc * 4294967296.0);
+    }
+    cdf[ALPHABET_N-1] = 0xFFFFFFFFu;
+
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "Error opening corpus file '%s'\n", path);
+        return 1;
+    }
+
+    unsigned long long state = CORPUS_SEED;
+    char *buf = malloc(CSTATS_BLOCK_SIZE);
+    for (long long written = 0; written < size; ) {
+        size_t n = size - written < CSTATS_BLOCK_SIZE ? size - written : CSTATS_BLOCK_SIZE;
+        for (size_t i = 0; i < n; i++) {
+            // xorshift64*
+            state ^= state >> 12;  state ^= state << 25;  state ^= state >> 27;
+            unsigned long long rnd = state * 0x2545F4914F6CDD1DULL;
+            unsigned int r = rnd >> 32;
+
+            if ((rnd & 0xFFFF) < NON_LETTER_RATIO * 0x10000) {
+                buf[i] = others[r % (sizeof(others) - 1)];
+                continue;
+            }
+            int l = 0;
+            while (r > cdf[l])  l++;
+            buf[i] = (rnd & 0x30000) ? order[l] | 0x20 : order[l];
+        }
+        fwrite(buf, 1, n, fp);
+        written += n;
+    }
+    free(buf);
+    fclose(fp);
+    return 0;
+}
+
+/** @brief Evicts a file from the page cache (cold cache runs). */
+static void drop_cache(char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)  return;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+/** @brief Reads a whole file so it is in the page cache (warm cache runs). */
+static void warm_cache(char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)  return;
+    char *buf = malloc(CSTATS_BLOCK_SIZE);
+    while (read(fd, buf, CSTATS_BLOCK_SIZE) > 0);
+    free(buf);
+    close(fd);
+}
+
+/** @brief Returns a monotonic timestamp in seconds. */
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+/** @brief Returns the time stamp counter, or 0 if there is none. */
+static unsigned long long cycles(void)
+{
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,164 @@
+#include "batch.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// State shared by the workers of a batch run
+typedef struct batch {
+    char **paths;
+    int npaths;
+    int csens;
+    int utf8;
+    BatchReport report;
+    void *arg;
+
+    // Index of the next path to take, and failures so far
+    pthread_mutex_t lock;
+    int next;
+    int nfailed;
+} Batch;
+
+// Per-worker state: the thread and its private aggregate (64-bit, since the
+// files of a batch can add up to more than 2^31 letters)
+typedef struct batch_worker {
+    Batch *batch;
+    CompactStats *total;
+    pthread_t thread;
+} BatchWorker;
+
+static void *batch_worker(void *worker_ptr);
+
+
+/** @brief Counts many files on a pool of threads and aggregates the results.
+ *
+ * Each worker repeatedly takes the next path from the list, counts it with
+ * `compact_count_path`, reports it through `report` and merges it into its own
+ * aggregate. The aggregates of all workers are merged at the end. Files are
+ * reported in the order they are finished, which may differ from `paths`.
+ *
+ * @param paths Paths of the files to count.
+ * @param npaths Number of paths.
+ * @param case_sensitive Whether the counts should be case-sensitive.
+ * @param utf8 Counting mode for non-ASCII input (see `cstats_set_utf8`).
+ * @param nthreads Number of workers. If 0 or less, one per online CPU.
+ * @param report Function called for every file, or NULL. It may be called
+ *               from several threads at once.
+ * @param arg Argument passed through to `report`.
+ * @param nfailed If not NULL, set to the number of files that couldn't be read.
+ * @return A new CompactStats object with the counts of all the files.
+ */
+CompactStats *batch_run(char **paths, int npaths, int case_sensitive, int utf8, int nthreads,
+                        BatchReport report, void *arg, int *nfailed)
+{
+    if (nthreads <= 0)  nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads > npaths)  nthreads = npaths;
+    if (nthreads <= 0)  nthreads = 1;
+
+    Batch batch = {
+        .paths = paths,
+        .npaths = npaths,
+        .csens = case_sensitive,
+        .utf8 = utf8,
+        .report = report,
+        .arg = arg,
+        .next = 0,
+        .nfailed = 0
+    };
+    pthread_mutex_init(&batch.lock, NULL);
+
+    // The calling thread is one of the workers
+    BatchWorker *workers = calloc(nthreads, sizeof(BatchWorker));
+    for (int t = 1; t < nthreads; t++) {
+        workers[t].batch = &batch;
+        workers[t].total = compact_init(case_sensitive, utf8);
+        // Without a thread, the remaining workers pick up its share
+        if (pthread_create(&workers[t].thread, NULL, batch_worker, &workers[t]) != 0) {
+            workers[t].batch = NULL;
+        }
+    }
+    workers[0].batch = &batch;
+    workers[0].total = compact_init(case_sensitive, utf8);
+    batch_worker(&workers[0]);
+
+    CompactStats *total = workers[0].total;
+    for (int t = 1; t < nthreads; t++) {
+        if (workers[t].batch != NULL)  pthread_join(workers[t].thread, NULL);
+        compact_merge(total, workers[t].total);
+        compact_free(workers[t].total);
+    }
+    free(workers);
+    pthread_mutex_destroy(&batch.lock);
+
+    if (nfailed != NULL)  *nfailed = batch.nfailed;
+    return total;
+}
+
+/** @brief Thread body for `batch_run`.
+ * @param worker_ptr Pointer to the `BatchWorker` running it
+ * @return NULL
+ */
+static void *batch_worker(void *worker_ptr)
+{
+    BatchWorker *worker = worker_ptr;
+    Batch *batch = worker->batch;
+    // Counts of the current file, reset for every file
+    CompactStats *file = compact_init(batch->csens, batch->utf8);
+
+    for (;;) {
+        pthread_mutex_lock(&batch->lock);
+        int i = batch->next < batch->npaths ? batch->next++ : -1;
+        pthread_mutex_unlock(&batch->lock);
+        if (i == -1)  break;
+
+        memset(file->counts, 0, sizeof(file->counts));
+        file->nbytes = 0;
+        int err = compact_count_path(file, batch->paths[i], 1);
+        if (batch->report != NULL)  batch->report(batch->paths[i], err ? NULL : file, batch->arg);
+        if (err) {
+            pthread_mutex_lock(&batch->lock);
+            batch->nfailed++;
+            pthread_mutex_unlock(&batch->lock);
+            continue;
+        }
+        compact_merge(worker->total, file);
+    }
+    compact_free(file);
+    return NULL;
+}
+
+
+/** @brief Reads a list of paths, one per line.
+ *
+ * Empty lines are skipped, and the trailing newline of each line is removed.
+ *
+ * @param fp File to read the list from (it may be `stdin`).
+ * @param npaths Set to the number of paths read.
+ * @return The array of paths. It must be freed with `batch_free_list`.
+ */
+char **batch_read_list(FILE *fp, int *npaths)
+{
+    int size = 64, n = 0;
+    char **paths = malloc(size * sizeof(char *));
+
+    char *line = NULL;
+    size_t nchars = 0;
+    ssize_t len;
+    while ((len = getline(&line, &nchars, fp)) != -1) {
+        if (len > 0 && line[len-1] == '\n')  line[--len] = '\0';
+        if (len == 0)  continue;
+        if (n == size)  paths = realloc(paths, (size *= 2) * sizeof(char *));
+        paths[n++] = strdup(line);
+    }
+    free(line);
+
+    *npaths = n;
+    return paths;
+}
+
+/** @brief Frees a list of paths read by `batch_read_list`. */
+void batch_free_list(char **paths, int npaths)
+{
+    for (int i = 0; i < npaths; i++)  free(paths[i]);
+    free(paths);
+}
@@ -0,0 +1,17 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+#include "compact.h"
+
+// Called once per file from the worker that counted it. `stats` is NULL if
+// the file couldn't be read, and is reused right after the call.
+typedef void (*BatchReport)(const char *path, const CompactStats *stats, void *arg);
+
+CompactStats *batch_run(char **paths, int npaths, int case_sensitive, int utf8, int nthreads,
+                        BatchReport report, void *arg, int *nfailed);
+
+char **batch_read_list(FILE *fp, int *npaths);
+void batch_free_list(char **paths, int npaths);
+
+#endif
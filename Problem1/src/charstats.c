@@ -2,10 +2,44 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "strutils.h"
+#include "histogram.h"
+#include "utf8.h"
+#include "mapping.h"
+
+// Size of a cache line, used to keep per-thread tables apart
+#define CACHE_LINE 64
+
+// Work unit for the parallel counting path
+typedef struct count_task {
+    // Private counts table, on its own cache lines
+    _Alignas(CACHE_LINE) int counts[CSTATS_SLOTS];
+    // Object being counted, shared (read-only) by all tasks for its tables
+    const CharStats *stats;
+    // Chunk of the file to count, the byte before it, and whether it reaches
+    // the end of the file
+    const u_char *buf;
+    u_char prev;
+    size_t len;
+    int last;
+    // Bytes of a UTF-8 sequence cut by the end of the last chunk
+    size_t rest;
+    pthread_t thread;
+    int threaded;
+} CountTask;
+
+_Static_assert(CSTATS_SINK == HIST_SLOTS-1, "the histogram sink must be the counts sink");
 
 static CharStats *cstats_init(int case_sensitive);
 static void cstats_free(CharStats *ptr_ptr);
+static int merge(CharStats *ptr, CharStats *other);
+
+static CharStats *cstats_init_mapped(char *path, int case_sensitive, int nthreads);
+static void count_parallel(CharStats *ptr, const u_char *buf, size_t len, int nthreads);
+static void *count_worker(void *task_ptr);
+static void count_fp(CharStats *ptr, FILE *fp);
 
 static void printa(CharStats *ptr);
 
@@ -32,11 +66,22 @@ static char *get_top_n_coll(CharStats *ptr, int n, const char *collection, int c
 static CharStats *cstats_init(int case_sensitive)
 {
     CharStats *ptr = calloc(1, sizeof(CharStats));
-    ptr->counts = calloc(ASCII_N, sizeof(int));
+    ptr->counts = calloc(CSTATS_SLOTS, sizeof(int));
     ptr->csens = case_sensitive;
-    ptr->_sum = 0;
+    ptr->utf8 = CSTATS_ASCII;
+    ptr->_npending = 0;
+    ptr->_prev = 0;
+    ptr->nbytes = 0;
+    ptr->_sum = -1;
+
+    // Fold table: ASCII bytes map to themselves (or their uppercase), the rest to the sink
+    for (int c = 0; c < 256; c++) {
+        if (c >= ASCII_N)  ptr->fold[c] = CSTATS_SINK;
+        else  ptr->fold[c] = ptr->csens==0 ? (u_char) toupper(c) : (u_char) c;
+    }
 
     ptr->free = cstats_free;
+    ptr->merge = merge;
 
     ptr->printa = printa;
 
@@ -52,11 +97,24 @@ static CharStats *cstats_init(int case_sensitive)
     return ptr;
 }
 
+/** @brief Initializes a new, empty CharStats object.
+ *
+ * All counts start at zero. Useful as the target of `merge`, or to feed data
+ * incrementally with `cstats_update`.
+ *
+ * @param case_sensitive Whether the CharStats object should be case-sensitive.
+ * @return A pointer to the newly created CharStats object.
+ */
+CharStats *cstats_init_empty(int case_sensitive)
+{
+    return cstats_init(case_sensitive);
+}
 /** @brief Initializes a new CharStats object and counts the occurrences of each character in a file specified by a path.
  *
  * This function opens the file specified by the given path and reads characters
  * from it, incrementing the corresponding count in the newly created CharStats
- * object. The `case_sensitive` parameter determines whether the object should
+ * object. The file is memory-mapped when possible (see `cstats_init_mmap`).
+ * The `case_sensitive` parameter determines whether the object should
  * be case-sensitive or not. The function returns a pointer to the newly created
  * CharStats object, or `NULL` if the file could not be opened.
  *
@@ -66,21 +124,68 @@ static CharStats *cstats_init(int case_sensitive)
  */
 CharStats *cstats_init_path(char *path, int case_sensitive)
 {
-    CharStats *ptr = NULL;
-    FILE *fp = fopen(path, "r");
-    if (fp == NULL) {
-        fprintf(stderr, "Error opening file '%s'\n", path);
-    }
-    else {
-        ptr = cstats_init_fp(fp, case_sensitive);
-        fclose(fp);
+    return cstats_init_mmap(path, case_sensitive);
+}
+/** @brief Initializes a new CharStats object by mapping a file specified by a path into memory.
+ *
+ * This function maps the file specified by the given path into memory and
+ * counts its characters directly from the mapping, without copying them
+ * through a stdio buffer. The mapping is advised as sequential so the kernel
+ * reads ahead aggressively. Files that can't be mapped (pipes, character
+ * devices, empty or special files) fall back to the stream path through
+ * `cstats_init_fp`, so the result is always the same.
+ *
+ * @param path The path to the file to read characters from.
+ * @param case_sensitive Whether the CharStats object should be case-sensitive.
+ * @return A pointer to the newly created CharStats object, or `NULL` if the file could not be opened.
+ */
+CharStats *cstats_init_mmap(char *path, int case_sensitive)
+{
+    return cstats_init_mapped(path, case_sensitive, 1);
+}
+/** @brief Initializes a new CharStats object by counting a file on several threads.
+ *
+ * This function maps the file specified by the given path into memory, splits
+ * it into `nthreads` contiguous chunks and counts each chunk on its own
+ * thread. Every thread counts into a private, cache-line aligned table, so
+ * there is no sharing or atomics while counting. The tables are added up into
+ * the object's counts array once all threads are done, which gives exactly the
+ * same counts as the serial path. Files that can't be mapped are counted
+ * serially through `cstats_init_fp`.
+ *
+ * @param path The path to the file to read characters from.
+ * @param case_sensitive Whether the CharStats object should be case-sensitive.
+ * @param nthreads Number of threads to use. If 0 or less, one per online CPU.
+ * @return A pointer to the newly created CharStats object, or `NULL` if the file could not be opened.
+ */
+CharStats *cstats_init_path_mt(char *path, int case_sensitive, int nthreads)
+{
+    return cstats_init_mapped(path, case_sensitive, nthreads);
+}
+
+/** @brief Initializes a new CharStats object and counts a file on the given number of threads.
+ *
+ * Shared implementation of `cstats_init_mmap` and `cstats_init_path_mt`.
+ *
+ * @param path The path to the file to read characters from.
+ * @param case_sensitive Whether the CharStats object should be case-sensitive.
+ * @param nthreads Number of threads to split the file between.
+ * @return A pointer to the newly created CharStats object, or `NULL` if the file could not be opened.
+ */
+static CharStats *cstats_init_mapped(char *path, int case_sensitive, int nthreads)
+{
+    CharStats *ptr = cstats_init(case_sensitive);
+    if (cstats_count_path(ptr, path, nthreads)) {
+        cstats_free(ptr);
+        return NULL;
     }
     return ptr;
 }
 /** @brief Initializes a new CharStats object and counts the occurrences of each character in a file.
  *
- * This function reads characters from the given file pointer and increments
- * the corresponding count in the newly created CharStats object. The `case_sensitive`
+ * This function reads the given file pointer in blocks of `CSTATS_BLOCK_SIZE`
+ * bytes and increments the corresponding count in the newly created CharStats
+ * object for each character. The `case_sensitive`
  * parameter determines whether the object should be case-sensitive or not. The
  * function returns a pointer to the newly created CharStats object.
  *
@@ -89,6 +194,21 @@ CharStats *cstats_init_path(char *path, int case_sensitive)
  * @return A pointer to the newly created CharStats object.
  */
 CharStats *cstats_init_fp(FILE *fp, int case_sensitive)
+{
+    CharStats *ptr = cstats_init(case_sensitive);
+    count_fp(ptr, fp);
+    return ptr;
+}
+/** @brief Initializes a new CharStats object, reading the file one character at a time.
+ *
+ * Same as `cstats_init_fp`, but reads the file with one `fgetc` call per
+ * character. It is much slower, and only kept as a reference for comparisons.
+ *
+ * @param fp The file pointer to read characters from.
+ * @param case_sensitive Whether the CharStats object should be case-sensitive.
+ * @return A pointer to the newly created CharStats object.
+ */
+CharStats *cstats_init_fp_bytewise(FILE *fp, int case_sensitive)
 {
     CharStats *ptr = cstats_init(case_sensitive);
     int c;
@@ -96,10 +216,224 @@ CharStats *cstats_init_fp(FILE *fp, int case_sensitive)
         if (c < ASCII_N) {
             ptr->counts[ptr->csens==0 ? (int) toupper(c) : (int) c]++;
         }
+        ptr->nbytes++;
     }
     return ptr;
 }
 
+/** @brief Sets how non-ASCII input is counted.
+ *
+ * In the default `CSTATS_ASCII` mode, every byte outside ASCII is ignored. In
+ * the UTF-8 modes, the input is decoded and counted once per code point:
+ * accented Latin-1 letters are counted as their base letter (Á as A, ü as U),
+ * and Ñ gets its own `CSTATS_ENYE` slot (`CSTATS_UTF8`) or is counted as N
+ * (`CSTATS_UTF8_BASE`). ASCII text is counted as fast as in the default mode.
+ * The mode must be set before counting anything.
+ *
+ * @param ptr A pointer to the CharStats object to configure.
+ * @param mode `CSTATS_ASCII`, `CSTATS_UTF8` or `CSTATS_UTF8_BASE`.
+ */
+void cstats_set_utf8(CharStats *ptr, int mode)
+{
+    ptr->utf8 = mode;
+    if (mode != CSTATS_ASCII)  utf8_fold_table(ptr->latin1, ptr->csens, mode);
+}
+
+/** @brief Counts a chunk of data into an existing CharStats object.
+ *
+ * This function adds the characters in `buf` to the counts of the object, as
+ * if they had been part of the file it was created from. It can be called any
+ * number of times, with chunks of any size, and the object can be queried
+ * between calls: the cached sum is invalidated so `get_freq` always uses the
+ * current counts. In the UTF-8 modes, a sequence cut by the end of a chunk is
+ * kept and completed with the start of the next one.
+ *
+ * @param ptr A pointer to the CharStats object to count into.
+ * @param buf The chunk of data to count.
+ * @param len The number of bytes in the chunk.
+ */
+void cstats_update(CharStats *ptr, const void *buf, size_t len)
+{
+    const u_char *bytes = buf;
+    ptr->nbytes += len;
+    ptr->_sum = -1;
+
+    if (ptr->utf8 == CSTATS_ASCII) {
+        hist_count(ptr->counts, ptr->fold, ptr->csens, bytes, len);
+        return;
+    }
+
+    // Finish the sequence cut by the last chunk
+    size_t i = 0;
+    while (ptr->_npending > 0 && i < len) {
+        if ((bytes[i] & 0xC0) != 0x80) { // Malformed, the new byte starts over
+            ptr->counts[CSTATS_SINK]++;
+            ptr->_prev = ptr->_pending[ptr->_npending-1];
+            ptr->_npending = 0;
+            break;
+        }
+        ptr->_pending[ptr->_npending++] = bytes[i++];
+        int n = utf8_seq_len(ptr->_pending[0]);
+        if (ptr->_npending == n) {
+            utf8_count_cp(ptr->counts, ptr->fold, ptr->latin1, ptr->_prev, utf8_decode(ptr->_pending, n));
+            ptr->_prev = ptr->_pending[n-1];
+            ptr->_npending = 0;
+        }
+    }
+    if (ptr->_npending > 0)  return; // Still incomplete, the chunk was too short
+
+    u_char prev = i > 0 ? bytes[i-1] : ptr->_prev;
+    size_t done = i + utf8_count(ptr->counts, ptr->fold, ptr->csens, ptr->latin1, prev, bytes + i, len - i);
+    if (done > 0)  ptr->_prev = bytes[done-1];
+    ptr->_npending = len - done;
+    memcpy(ptr->_pending, bytes + done, ptr->_npending);
+}
+
+/** @brief Counts a file specified by a path into an existing CharStats object.
+ *
+ * The file is memory-mapped and counted directly from the mapping, advised as
+ * sequential so the kernel reads ahead aggressively. With more than one
+ * thread, the mapping is split into contiguous chunks counted in parallel
+ * into private, cache-line aligned tables, which are added up once all
+ * threads are done. In the UTF-8 modes, chunks are split between sequences.
+ * The result is always the same as `cstats_update` over the whole file.
+ * Files that can't be mapped (pipes, character devices, empty or special
+ * files) are read serially as a stream.
+ *
+ * @param ptr A pointer to the CharStats object to count into.
+ * @param path The path to the file to read characters from.
+ * @param nthreads Number of threads to use. If 0 or less, one per online CPU.
+ * @return 0 if the file was counted, 1 if it could not be opened.
+ */
+int cstats_count_path(CharStats *ptr, char *path, int nthreads)
+{
+    Mapping map;
+    if (map_open(&map, path))  return 1;
+
+    if (map.data == NULL)  count_fp(ptr, map.fp);
+    else  cstats_count_buf(ptr, map.data, map.len, nthreads);
+
+    map_close(&map);
+    return 0;
+}
+/** @brief Counts a block of memory into an existing CharStats object on several threads.
+ *
+ * Same as `cstats_update`, but the block is split into contiguous chunks
+ * counted in parallel (see `cstats_count_path`).
+ *
+ * @param ptr A pointer to the CharStats object to count into.
+ * @param buf The block of bytes to count.
+ * @param len The number of bytes in the block.
+ * @param nthreads Number of threads to use. If 0 or less, one per online CPU.
+ */
+void cstats_count_buf(CharStats *ptr, const void *buf, size_t len, int nthreads)
+{
+    nthreads = cstats_count_threads(len, nthreads);
+
+    // A pending UTF-8 sequence must be completed in order, so go serial
+    if (nthreads <= 1 || ptr->_npending > 0)  cstats_update(ptr, buf, len);
+    else  count_parallel(ptr, buf, len, nthreads);
+}
+
+/** @brief Returns the number of threads `cstats_count_buf` splits a block between.
+ * @param len The number of bytes in the block.
+ * @param nthreads Number of threads asked for. If 0 or less, one per online CPU.
+ * @return The number of threads, at least 1 and at most `len`.
+ */
+int cstats_count_threads(size_t len, int nthreads)
+{
+    if (nthreads <= 0)  nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if ((size_t) nthreads > len)  nthreads = len;
+    return nthreads > 1 ? nthreads : 1;
+}
+
+/** @brief Counts a block of memory on several threads.
+ *
+ * @param ptr A pointer to the CharStats object to count into (with no pending UTF-8 sequence).
+ * @param buf The block of bytes to count.
+ * @param len The number of bytes in the block.
+ * @param nthreads Number of threads to split the block between.
+ */
+static void count_parallel(CharStats *ptr, const u_char *buf, size_t len, int nthreads)
+{
+    CountTask *tasks = aligned_alloc(CACHE_LINE, nthreads * sizeof(CountTask));
+    size_t chunk = len / nthreads;
+    size_t start = 0;
+    for (int t = 0; t < nthreads; t++) {
+        size_t end = (t == nthreads-1) ? len : (t+1)*chunk;
+        // Don't split a UTF-8 sequence: skip up to 3 continuation bytes
+        for (int k = 0; ptr->utf8 && k < 3 && end < len && (buf[end] & 0xC0) == 0x80; k++)  end++;
+        if (end < start)  end = start;
+
+        memset(tasks[t].counts, 0, sizeof(tasks[t].counts));
+        tasks[t].stats = ptr;
+        tasks[t].buf = buf + start;
+        tasks[t].prev = start > 0 ? buf[start-1] : ptr->_prev;
+        tasks[t].len = end - start;
+        tasks[t].last = end == len;
+        tasks[t].rest = 0;
+        start = end;
+
+        // If the thread can't be created, count the chunk here instead
+        tasks[t].threaded = pthread_create(&tasks[t].thread, NULL, count_worker, &tasks[t]) == 0;
+        if (!tasks[t].threaded)  count_worker(&tasks[t]);
+    }
+    for (int t = 0; t < nthreads; t++) {
+        if (tasks[t].threaded)  pthread_join(tasks[t].thread, NULL);
+        for (int c = 0; c < CSTATS_SLOTS; c++)  ptr->counts[c] += tasks[t].counts[c];
+
+        // Keep a sequence cut by the end of the block, as cstats_update does
+        if (tasks[t].rest > 0) {
+            ptr->_npending = tasks[t].rest;
+            memcpy(ptr->_pending, tasks[t].buf + tasks[t].len - tasks[t].rest, tasks[t].rest);
+        }
+    }
+    size_t done = len - ptr->_npending;
+    if (done > 0)  ptr->_prev = buf[done-1];
+
+    free(tasks);
+    ptr->nbytes += len;
+    ptr->_sum = -1;
+}
+
+/** @brief Thread body for the parallel counting path.
+ * @param task_ptr Pointer to the `CountTask` to count
+ * @return NULL
+ */
+static void *count_worker(void *task_ptr)
+{
+    CountTask *task = task_ptr;
+    const CharStats *cfg = task->stats;
+    if (cfg->utf8 == CSTATS_ASCII) {
+        hist_count(task->counts, cfg->fold, cfg->csens, task->buf, task->len);
+        return NULL;
+    }
+
+    size_t done = utf8_count(task->counts, cfg->fold, cfg->csens, cfg->latin1, task->prev,
+                             task->buf, task->len);
+    task->rest = task->len - done;
+    // A cut sequence before the next chunk is malformed, as in cstats_update
+    if (task->rest > 0 && !task->last) {
+        task->counts[CSTATS_SINK]++;
+        task->rest = 0;
+    }
+    return NULL;
+}
+
+/** @brief Reads a stream in blocks of `CSTATS_BLOCK_SIZE` bytes and counts them.
+ * @param ptr A pointer to the CharStats object to count into.
+ * @param fp The file pointer to read characters from.
+ */
+static void count_fp(CharStats *ptr, FILE *fp)
+{
+    u_char *buf = malloc(CSTATS_BLOCK_SIZE);
+    size_t nread;
+    while ((nread = fread(buf, 1, CSTATS_BLOCK_SIZE, fp)) > 0) {
+        cstats_update(ptr, buf, nread);
+    }
+    free(buf);
+}
+
 
 /** @brief Frees the memory allocated for a CharStats object.
  *
@@ -115,6 +449,28 @@ static void cstats_free(CharStats *ptr)
     free(ptr);
 }
 
+/** @brief Adds the counts of another CharStats object into this one.
+ *
+ * This function adds every count of `other` to the corresponding count of
+ * `ptr`, so `ptr` ends up with the statistics of both inputs combined. Both
+ * objects must have the same case sensitivity and counting mode. `other` is not modified. The
+ * cached sum of `ptr` is reset, since it no longer matches its counts.
+ *
+ * @param ptr A pointer to the CharStats object to merge into.
+ * @param other A pointer to the CharStats object to merge from.
+ * @return 0 if the objects were merged, 1 if their case sensitivity or mode differs.
+ */
+static int merge(CharStats *ptr, CharStats *other)
+{
+    if (ptr->csens != other->csens || ptr->utf8 != other->utf8)  return 1;
+    for (int c = 0; c < CSTATS_SLOTS; c++) {
+        ptr->counts[c] += other->counts[c];
+    }
+    ptr->nbytes += other->nbytes;
+    ptr->_sum = -1;
+    return 0;
+}
+
 /** @brief Prints the counts of all characters in a CharStats object.
  *
  * Prints the counts of all characters in a CharStats object's counts array.
@@ -188,7 +544,7 @@ static int sum(CharStats *ptr, const char* collection, int char_n)
  */
 static int get_count(CharStats *ptr, char c)
 {
-    return ptr->counts[ptr->csens==0 ? (int) toupper(c) : (int) c];
+    return ptr->counts[ptr->fold[(u_char) c]];
 }
 /** @brief Gets the frequency for a character in a CharStats object.
  *
@@ -206,46 +562,103 @@ static int get_count(CharStats *ptr, char c)
  */
 static float get_freq(CharStats *ptr, char c)
 {
-    if (ptr->_sum == 0)  ptr->sum(ptr, ALPHABET, ALPHABET_N);
-    return (float) ptr->counts[ptr->csens==0 ? (u_char) toupper(c) : (u_char) c] / ptr->_sum;
+    if (ptr->_sum < 0)  ptr->sum(ptr, ALPHABET, ALPHABET_N);
+    return (float) ptr->counts[ptr->fold[(u_char) c]] / ptr->_sum;
+}
+
+/** @brief Writes the top n characters from a collection into caller-provided storage.
+ *
+ * This function selects the `n` characters of `collection` with the highest
+ * counts and writes them to `out` in descending order of count, followed by a
+ * `'\0'`. Characters with the same count are ordered by their code, so the
+ * result is always the same for the same counts. The selection keeps a sorted
+ * window of the best `n` characters seen so far, which takes
+ * O(`char_n` * `n`) steps in the worst case and allocates nothing.
+ * Non-ASCII characters in the collection are skipped.
+ *
+ * @param counts Counts to rank the characters by, indexed by character code
+ *               (at least `ASCII_N` of them).
+ * @param n Number of characters to select.
+ * @param collection Array of characters to select from.
+ * @param char_n Number of characters in the collection.
+ * @param out Buffer for the result, with room for at least `n`+1 characters
+ *            (or `char_n`+1 if it's smaller).
+ * @return The number of characters written to `out`, without the `'\0'`.
+ */
+int counts_top_n_into(const uint64_t *counts, int n, const char *collection, int char_n, char *out)
+{
+    if (n > char_n)  n = char_n;
+    int len = 0;
+    for (int i = 0; i < char_n; i++) {
+        u_char c = collection[i];
+        if (c >= ASCII_N)  continue;
+
+        // Move up past every character that ranks after this one
+        int j = len;
+        while (j > 0) {
+            u_char o = out[j-1];
+            if (counts[c] < counts[o] || (counts[c] == counts[o] && c > o))  break;
+            j--;
+        }
+        if (j >= n)  continue;
+
+        if (len < n)  len++;
+        memmove(out + j + 1, out + j, len - 1 - j);
+        out[j] = c;
+    }
+    out[len] = '\0';
+    return len;
 }
 
-/** @brief Compares the counts of two characters in a CharStats object. */
-static int countcmp(const void *a, const void *b, CharStats *ptr)
+/** @brief Writes the top n characters of a CharStats object into caller-provided storage.
+ *
+ * Same as `counts_top_n_into` over the counts of the object.
+ *
+ * @param ptr A pointer to the CharStats object to rank the characters by.
+ * @param n Number of characters to select.
+ * @param collection Array of characters to select from.
+ * @param char_n Number of characters in the collection.
+ * @param out Buffer for the result, with room for at least `n`+1 characters
+ *            (or `char_n`+1 if it's smaller).
+ * @return The number of characters written to `out`, without the `'\0'`.
+ */
+int cstats_top_n_into(CharStats *ptr, int n, const char *collection, int char_n, char *out)
 {
-    return ptr->counts[*(u_char *) b] - ptr->counts[*(u_char *) a];
+    uint64_t counts[ASCII_N];
+    for (int c = 0; c < ASCII_N; c++)  counts[c] = ptr->counts[c];
+    return counts_top_n_into(counts, n, collection, char_n, out);
 }
+
 /** @brief Returns a sorted array of all ASCII characters based on their counts in a CharStats object.
  *
  * Returns a sorted array of all ASCII characters based on their counts in a CharStats object's counts array.
  * The `ptr` parameter should be a pointer to an initialized CharStats object.
- * The returned array is sorted in ascending order of character counts.
+ * The returned array is sorted in descending order of character counts (see `cstats_top_n_into`).
  *
  * @param ptr A pointer to the CharStats object to sort the characters by.
  * @return A pointer to the sorted array of characters.
  */
 static char *get_sorted(CharStats *ptr)
 {
-    char *sorted = malloc((ASCII_N)*sizeof(char));
-    memcpy(sorted, ASCII, ASCII_N);
-    qsort_r(sorted, ASCII_N, sizeof(char), countcmp, ptr);
+    char *sorted = malloc((ASCII_N+1)*sizeof(char));
+    cstats_top_n_into(ptr, ASCII_N, ASCII, ASCII_N, sorted);
     return sorted;
 }
 
-/** @brief Calculates the total count of all characters in a CharStats object.
+/** @brief Returns the top n characters in a CharStats object.
  *
- * Calculates the total count of all characters in a CharStats object's counts array.
+ * Returns a string with the `n` ASCII characters with the highest counts in a
+ * CharStats object's counts array, in descending order of count.
  * The `ptr` parameter should be a pointer to an initialized CharStats object.
  *
- * @param ptr A pointer to the CharStats object to calculate the total count of.
- * @return The total count of all characters in the CharStats object.
+ * @param ptr A pointer to the CharStats object to rank the characters by.
+ * @param n Number of characters to return.
+ * @return String containing the top `n` characters.
+ * @note The returned string must be freed by the caller.
  */
 static char *get_top_n(CharStats *ptr, int n)
 {
-    char *sorted = ptr->get_sorted(ptr);
-    char *top_n = strslice(sorted, 0, n);
-    free(sorted);
-    return top_n;
+    return ptr->get_top_n_coll(ptr, n, ASCII, ASCII_N);
 }
 
 /**
@@ -253,9 +666,8 @@ static char *get_top_n(CharStats *ptr, int n)
  *
  * This function takes a pointer to a `CharStats` struct, an integer `n`, a string `collection`,
  * and an integer `char_n`. It returns a string containing the top `n` characters from the given
- * `collection`, sorted in descending order. The `CharStats` struct must have a `get_sorted`
- * function that returns a string containing all the characters in the struct, sorted in
- * descending order of frequency.
+ * `collection`, sorted in descending order. The selection is done by `cstats_top_n_into`
+ * directly over the collection.
  *
  * @param ptr Pointer to a `CharStats` struct.
  * @param n Number of characters to return.
@@ -266,13 +678,7 @@ static char *get_top_n(CharStats *ptr, int n)
  */
 static char *get_top_n_coll(CharStats *ptr, int n, const char *collection, int char_n)
 {
-    char *sorted = ptr->get_sorted(ptr);
     char *filtered = calloc(char_n+1, sizeof(char));
-    int j = 0;
-    for (int i=0; j < n && i < ASCII_N; i++) {
-        if (strchr(collection, sorted[i]) != NULL)  filtered[j++] = sorted[i];
-    }
-    filtered[j] = '\0';
-    free(sorted);
+    cstats_top_n_into(ptr, n, collection, char_n, filtered);
     return filtered;
 }
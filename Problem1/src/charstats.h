@@ -2,16 +2,46 @@
 #define CHARSTATS_H
 
 #include <stdio.h>
+#include <stdint.h>
+
+// Size of the blocks read at once when counting from a stream
+#define CSTATS_BLOCK_SIZE (64*1024)
+// Index of the counts slot that swallows non-ASCII bytes
+#define CSTATS_SINK 128
+// Slots for Ñ and ñ in UTF-8 mode (ñ only has its own if case-sensitive)
+#define CSTATS_ENYE 129
+#define CSTATS_ENYE_LOWER 130
+// Number of slots in the counts array (ASCII, the sink and the extra letters)
+#define CSTATS_SLOTS 131
+
+// How non-ASCII input is counted (see cstats_set_utf8)
+#define CSTATS_ASCII 0      // Non-ASCII bytes are ignored
+#define CSTATS_UTF8 1       // UTF-8, accented letters fold to their base, Ñ on its own
+#define CSTATS_UTF8_BASE 2  // UTF-8, all Latin-1 letters fold to their base, Ñ too
 
 typedef struct char_stats {
     // Counts of each character
     int *counts;
     // Case sensitivity
     int csens;
-    // Total number of characters as last counted by the sum() function
+    // Byte to counts slot lookup table, built once on init
+    unsigned char fold[256];
+    // Non-ASCII counting mode, and the Latin-1 fold table for the UTF-8 modes
+    int utf8;
+    unsigned char latin1[64];
+    // Start of a UTF-8 sequence cut by the end of the last chunk, and the
+    // byte before it (or the last byte, if there is no such sequence)
+    unsigned char _pending[4];
+    int _npending;
+    unsigned char _prev;
+    // Number of bytes counted so far
+    long long nbytes;
+    // Total number of characters as last counted by the sum() function,
+    // or -1 if the counts changed since then
     int _sum;
 
     void (*free)(struct char_stats *);
+    int (*merge)(struct char_stats *, struct char_stats *);
 
     void (*printa)(struct char_stats *);
     
@@ -27,7 +57,19 @@ typedef struct char_stats {
 
 } CharStats;
 
+CharStats *cstats_init_empty(int case_sensitive);
 CharStats *cstats_init_path(char *path, int case_sensitive);
+CharStats *cstats_init_mmap(char *path, int case_sensitive);
+CharStats *cstats_init_path_mt(char *path, int case_sensitive, int nthreads);
 CharStats *cstats_init_fp(FILE *fp, int case_sensitive);
+CharStats *cstats_init_fp_bytewise(FILE *fp, int case_sensitive);
+
+void cstats_set_utf8(CharStats *ptr, int mode);
+void cstats_update(CharStats *ptr, const void *buf, size_t len);
+int cstats_count_path(CharStats *ptr, char *path, int nthreads);
+void cstats_count_buf(CharStats *ptr, const void *buf, size_t len, int nthreads);
+int cstats_count_threads(size_t len, int nthreads);
+int cstats_top_n_into(CharStats *ptr, int n, const char *collection, int char_n, char *out);
+int counts_top_n_into(const uint64_t *counts, int n, const char *collection, int char_n, char *out);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,186 @@
+#include "compact.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "mapping.h"
+
+// Bytes counted through a CharStats object before moving its counts to the
+// 64-bit ones, so its int counters can't overflow
+#define COMPACT_SPAN ((size_t) 1 << 30)
+
+
+/** @brief Initializes a new, empty CompactStats object.
+ *
+ * The whole object is a single cache-line aligned allocation.
+ *
+ * @param case_sensitive Whether the object should be case-sensitive.
+ * @param utf8 Counting mode for non-ASCII input (see `cstats_set_utf8`).
+ * @return A pointer to the newly created CompactStats object.
+ */
+CompactStats *compact_init(int case_sensitive, int utf8)
+{
+    CompactStats *cs = aligned_alloc(_Alignof(CompactStats), sizeof(CompactStats));
+    memset(cs, 0, sizeof(*cs));
+    cs->csens = case_sensitive;
+    cs->utf8 = utf8;
+    return cs;
+}
+
+/** @brief Frees a CompactStats object. */
+void compact_free(CompactStats *cs)
+{
+    free(cs);
+}
+
+/** @brief Adds the counts of another CompactStats object into this one.
+ * @param cs Object to merge into.
+ * @param other Object to merge from, not modified.
+ * @return 0 if the objects were merged, 1 if their case sensitivity or mode differs.
+ */
+int compact_merge(CompactStats *cs, const CompactStats *other)
+{
+    if (cs->csens != other->csens || cs->utf8 != other->utf8)  return 1;
+    for (int c = 0; c < CSTATS_SLOTS; c++)  cs->counts[c] += other->counts[c];
+    cs->nbytes += other->nbytes;
+    return 0;
+}
+
+
+/** @brief Counts a file specified by a path into a CompactStats object.
+ *
+ * Same as `cstats_count_path`, but the counts can go past 2^31.
+ *
+ * @param cs Object to count into.
+ * @param path The path to the file to read characters from.
+ * @param nthreads Number of threads to use. If 0 or less, one per online CPU.
+ * @return 0 if the file was counted, 1 if it could not be opened.
+ */
+int compact_count_path(CompactStats *cs, char *path, int nthreads)
+{
+    Mapping map;
+    if (map_open(&map, path))  return 1;
+
+    if (map.data != NULL) {
+        compact_count_buf(cs, map.data, map.len, nthreads);
+    }
+    else {
+        CharStats *scratch = compact_scratch(cs);
+        unsigned char *buf = malloc(CSTATS_BLOCK_SIZE);
+        size_t nread;
+        while ((nread = fread(buf, 1, CSTATS_BLOCK_SIZE, map.fp)) > 0) {
+            compact_feed(cs, scratch, buf, nread, 1);
+        }
+        free(buf);
+        scratch->free(scratch);
+    }
+
+    map_close(&map);
+    return 0;
+}
+
+/** @brief Counts a block of memory into a CompactStats object.
+ *
+ * Same as `compact_feed` through a scratch object of its own, so a UTF-8
+ * sequence cut by the end of the block is dropped.
+ *
+ * @param cs Object to count into.
+ * @param buf The block of bytes to count.
+ * @param len The number of bytes in the block.
+ * @param nthreads Number of threads to use. If 0 or less, one per online CPU.
+ */
+void compact_count_buf(CompactStats *cs, const void *buf, size_t len, int nthreads)
+{
+    CharStats *scratch = compact_scratch(cs);
+    compact_feed(cs, scratch, buf, len, nthreads);
+    scratch->free(scratch);
+}
+
+/** @brief Creates an empty CharStats object to count into a CompactStats object.
+ *
+ * It has the same settings as `cs`, and is meant to be passed to every
+ * `compact_feed` call over the same input so it can carry the UTF-8 decoding
+ * state between them. It must be freed by the caller.
+ */
+CharStats *compact_scratch(const CompactStats *cs)
+{
+    CharStats *scratch = cstats_init_empty(cs->csens);
+    cstats_set_utf8(scratch, cs->utf8);
+    return scratch;
+}
+
+/** @brief Counts a block of memory into a CompactStats object, through a scratch CharStats.
+ *
+ * The block is counted by the CharStats code (`cstats_count_buf`) in spans of
+ * `COMPACT_SPAN` bytes, each moved to the 64-bit counters before the next one,
+ * so the int counters of `scratch` can't overflow. In the UTF-8 modes, spans
+ * end between sequences so each of them can still be split between threads,
+ * and a sequence cut by the end of the block is completed by the next call.
+ *
+ * @param cs Object to count into.
+ * @param scratch Object made by `compact_scratch`, its counts are reset.
+ * @param buf The block of bytes to count.
+ * @param len The number of bytes in the block.
+ * @param nthreads Number of threads to use. If 0 or less, one per online CPU.
+ */
+void compact_feed(CompactStats *cs, CharStats *scratch, const void *buf, size_t len, int nthreads)
+{
+    const unsigned char *bytes = buf;
+    while (len > 0) {
+        size_t span = len < COMPACT_SPAN ? len : COMPACT_SPAN;
+        if (cs->utf8 != CSTATS_ASCII && span < len) {
+            for (int k = 0; k < 3 && (bytes[span] & 0xC0) == 0x80; k++)  span--;
+        }
+        cstats_count_buf(scratch, bytes, span, nthreads);
+        compact_add(cs, scratch);
+        memset(scratch->counts, 0, CSTATS_SLOTS * sizeof(int));
+        scratch->nbytes = 0;
+        bytes += span;  len -= span;
+    }
+}
+
+
+/** @brief Writes the top n characters from a collection into caller-provided storage.
+ *
+ * Same as `counts_top_n_into` over the counts of the object.
+ *
+ * @param cs Object to rank the characters by.
+ * @param n Number of characters to select.
+ * @param collection Array of characters to select from.
+ * @param char_n Number of characters in the collection.
+ * @param out Buffer for the result, with room for at least `n`+1 characters.
+ * @return The number of characters written to `out`, without the `'\0'`.
+ */
+int compact_top_n_into(const CompactStats *cs, int n, const char *collection, int char_n, char *out)
+{
+    return counts_top_n_into(cs->counts, n, collection, char_n, out);
+}
+
+
+/** @brief Adds the counts of a CharStats object into a CompactStats object.
+ * @param cs Object to merge into.
+ * @param stats CharStats object to merge from, not modified.
+ * @return 0 if the objects were merged, 1 if their case sensitivity or mode differs.
+ */
+int compact_add(CompactStats *cs, const CharStats *stats)
+{
+    if (cs->csens != stats->csens || cs->utf8 != stats->utf8)  return 1;
+    for (int c = 0; c < CSTATS_SLOTS; c++)  cs->counts[c] += stats->counts[c];
+    cs->nbytes += stats->nbytes;
+    return 0;
+}
+
+/** @brief Creates a CharStats object with the counts of a CompactStats object.
+ *
+ * Compatibility shim, so compact results can go through code written for the
+ * CharStats API. Counts that don't fit in an int are clamped to `INT_MAX`.
+ */
+CharStats *cstats_from_compact(const CompactStats *cs)
+{
+    CharStats *stats = cstats_init_empty(cs->csens);
+    cstats_set_utf8(stats, cs->utf8);
+    for (int c = 0; c < CSTATS_SLOTS; c++) {
+        stats->counts[c] = cs->counts[c] > INT_MAX ? INT_MAX : (int) cs->counts[c];
+    }
+    stats->nbytes = cs->nbytes;
+    return stats;
+}
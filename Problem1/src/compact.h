@@ -0,0 +1,71 @@
+#ifndef COMPACT_H
+#define COMPACT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "charstats.h"
+#include "strutils.h"
+
+// Letter statistics in one cache-line aligned block, with 64-bit counters and
+// no function pointers. Meant to be kept by the thousands (one per file of a
+// batch run) and queried through the inline accessors below. Counting is
+// done by the CharStats code in spans short enough for its int counters, so
+// the results are the same.
+typedef struct compact_stats {
+    // Counts of each slot (same slots as CharStats)
+    _Alignas(64) uint64_t counts[CSTATS_SLOTS];
+    // Number of bytes counted so far
+    uint64_t nbytes;
+    // Case sensitivity and non-ASCII counting mode (see cstats_set_utf8)
+    int32_t csens;
+    int32_t utf8;
+} CompactStats;
+
+CompactStats *compact_init(int case_sensitive, int utf8);
+void compact_free(CompactStats *cs);
+int compact_merge(CompactStats *cs, const CompactStats *other);
+int compact_add(CompactStats *cs, const CharStats *stats);
+
+int compact_count_path(CompactStats *cs, char *path, int nthreads);
+void compact_count_buf(CompactStats *cs, const void *buf, size_t len, int nthreads);
+CharStats *compact_scratch(const CompactStats *cs);
+void compact_feed(CompactStats *cs, CharStats *scratch, const void *buf, size_t len, int nthreads);
+int compact_top_n_into(const CompactStats *cs, int n, const char *collection, int char_n, char *out);
+
+CharStats *cstats_from_compact(const CompactStats *cs);
+
+
+/** @brief Returns the counts slot of a character (its uppercase if not case-sensitive). */
+static inline int compact_slot(const CompactStats *cs, char c)
+{
+    unsigned char u = c;
+    if (u >= ASCII_N)  return CSTATS_SINK;
+    if (!cs->csens && (unsigned) (u - 'a') < ALPHABET_N)  return u - ('a' - 'A');
+    return u;
+}
+
+/** @brief Returns the count of a character, like `CharStats.get_count`. */
+static inline uint64_t compact_get_count(const CompactStats *cs, char c)
+{
+    return cs->counts[compact_slot(cs, c)];
+}
+
+/** @brief Returns the sum of the counts of a set of characters, like `CharStats.sum`. */
+static inline uint64_t compact_sum(const CompactStats *cs, const char *collection, int char_n)
+{
+    uint64_t sum = 0;
+    for (int i = 0; i < char_n; i++)  sum += cs->counts[compact_slot(cs, collection[i])];
+    return sum;
+}
+
+/** @brief Returns the frequency of a character among the letters, like `CharStats.get_freq`.
+ *
+ * There is no cached sum: the 26 letter counts are added up on every call,
+ * which is cheaper than keeping a cache valid.
+ */
+static inline double compact_get_freq(const CompactStats *cs, char c)
+{
+    return (double) compact_get_count(cs, c) / compact_sum(cs, ALPHABET, ALPHABET_N);
+}
+
+#endif
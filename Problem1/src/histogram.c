@@ -0,0 +1,234 @@
+#include "histogram.h"
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HIST_X86 1
+#endif
+
+// Number of interleaved sub-histograms. Consecutive bytes go to different
+// tables, so runs of the same letter don't wait on each other's increments.
+#define HIST_WAYS 4
+// Bytes counted into the sub-histograms before adding them to the output, so
+// the 32-bit sub-histogram slots can't overflow
+#define HIST_SPAN ((size_t) 1 << 30)
+// Slot that receives all non-ASCII bytes
+#define HIST_SINK (HIST_SLOTS-1)
+
+typedef uint32_t SubHist[HIST_WAYS][HIST_SLOTS];
+typedef size_t (*HistKernel)(SubHist sub, const unsigned char *fold, int csens,
+                             const unsigned char *buf, size_t len);
+
+static size_t kernel_scalar(SubHist sub, const unsigned char *fold, int csens,
+                            const unsigned char *buf, size_t len);
+#ifdef HIST_X86
+static size_t kernel_sse2(SubHist sub, const unsigned char *fold, int csens,
+                          const unsigned char *buf, size_t len);
+static size_t kernel_avx2(SubHist sub, const unsigned char *fold, int csens,
+                          const unsigned char *buf, size_t len);
+#endif
+
+static void hist_resolve(void);
+
+
+// Available kernels. The scalar one must stay first, it is always supported.
+static const struct {
+    const char *name;
+    HistKernel kernel;
+} kernels[] = {
+    { "scalar", kernel_scalar },
+#ifdef HIST_X86
+    { "sse2", kernel_sse2 },
+    { "avx2", kernel_avx2 },
+#endif
+};
+#define KERNELS_N (sizeof(kernels) / sizeof(kernels[0]))
+
+// Index of the kernel in use, resolved once on the first call
+static int kernel_idx = -1;
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+
+/** @brief Counts a block of bytes into a counts table.
+ *
+ * Each byte is mapped to a slot as the `fold` table says: ASCII bytes to
+ * themselves (or their uppercase if not `case_sensitive`) and everything else
+ * to the sink slot. The counting is done by the best kernel the CPU supports,
+ * chosen on the first call (see `hist_select`). All kernels give the exact
+ * same counts.
+ *
+ * @param counts The counts table to increment, with `HIST_SLOTS` slots.
+ * @param fold Byte to slot table, used by the scalar kernel. The vector
+ *             kernels compute the same mapping from `case_sensitive`.
+ * @param case_sensitive Whether lowercase letters are counted on their own.
+ * @param buf The block of bytes to count.
+ * @param len The number of bytes in the block.
+ */
+void hist_count(int *counts, const unsigned char *fold, int case_sensitive,
+                const unsigned char *buf, size_t len)
+{
+    pthread_once(&kernel_once, hist_resolve);
+    HistKernel kernel = kernels[kernel_idx].kernel;
+
+    SubHist sub;
+    while (len > 0) {
+        size_t span = len < HIST_SPAN ? len : HIST_SPAN;
+        memset(sub, 0, sizeof(sub));
+
+        // The kernels leave a tail shorter than their vector width
+        size_t done = kernel(sub, fold, case_sensitive, buf, span);
+        for (size_t i = done; i < span; i++)  sub[0][fold[buf[i]]]++;
+
+        for (int c = 0; c < HIST_SLOTS; c++) {
+            uint32_t total = 0;
+            for (int w = 0; w < HIST_WAYS; w++)  total += sub[w][c];
+            counts[c] += total;
+        }
+        buf += span;  len -= span;
+    }
+}
+
+/** @brief Returns the name of the kernel used by `hist_count`. */
+const char *hist_kernel_name(void)
+{
+    pthread_once(&kernel_once, hist_resolve);
+    return kernels[kernel_idx].name;
+}
+
+/** @brief Forces `hist_count` to use the kernel with the given name.
+ *
+ * Meant for testing and benchmarking. Selecting a kernel the CPU doesn't
+ * support is refused.
+ *
+ * @param name Kernel name: "avx2", "sse2" or "scalar".
+ * @return 0 if the kernel was selected, 1 if it doesn't exist or isn't supported.
+ */
+int hist_select(const char *name)
+{
+    pthread_once(&kernel_once, hist_resolve);
+    for (size_t i = 0; i < KERNELS_N; i++) {
+        if (strcmp(kernels[i].name, name) != 0)  continue;
+#ifdef HIST_X86
+        if (kernels[i].kernel == kernel_avx2 && !__builtin_cpu_supports("avx2"))  return 1;
+#endif
+        kernel_idx = i;
+        return 0;
+    }
+    return 1;
+}
+
+/** @brief Picks the best kernel for this CPU (through CPUID).
+ *
+ * AVX2 is used when available. Otherwise the scalar kernel is preferred over
+ * the SSE2 one: with only 16 bytes per vector, extracting the slots costs as
+ * much as the fold table lookups it saves.
+ */
+static void hist_resolve(void)
+{
+    kernel_idx = 0;
+#ifdef HIST_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))  kernel_idx = 2;
+#endif
+}
+
+
+/** @brief Portable kernel: table lookup into interleaved sub-histograms.
+ * @return Number of bytes counted (a multiple of `HIST_WAYS`)
+ */
+static size_t kernel_scalar(SubHist sub, const unsigned char *fold, int csens,
+                            const unsigned char *buf, size_t len)
+{
+    (void) csens;
+    size_t i;
+    for (i = 0; i + HIST_WAYS <= len; i += HIST_WAYS) {
+        sub[0][fold[buf[i]]]++;
+        sub[1][fold[buf[i+1]]]++;
+        sub[2][fold[buf[i+2]]]++;
+        sub[3][fold[buf[i+3]]]++;
+    }
+    return i;
+}
+
+#ifdef HIST_X86
+/** @brief Scatters 8 already folded slots, packed in a word, into the sub-histograms.
+ *
+ * Slots are taken from a general purpose register instead of being stored to
+ * memory and loaded back one byte at a time.
+ */
+static inline void scatter(SubHist sub, uint64_t w)
+{
+    sub[0][w & 0xff]++;
+    sub[1][(w >> 8) & 0xff]++;
+    sub[2][(w >> 16) & 0xff]++;
+    sub[3][(w >> 24) & 0xff]++;
+    sub[0][(w >> 32) & 0xff]++;
+    sub[1][(w >> 40) & 0xff]++;
+    sub[2][(w >> 48) & 0xff]++;
+    sub[3][w >> 56]++;
+}
+
+/** @brief SSE2 kernel: folds 16 bytes at a time with vector compares.
+ *
+ * Non-ASCII bytes are clamped to the sink slot with an unsigned min, and
+ * lowercase letters get 0x20 subtracted where a signed range check matches.
+ * The sink (0x80) is negative as a signed byte, so it never matches the range.
+ *
+ * @return Number of bytes counted (a multiple of 16)
+ */
+static size_t kernel_sse2(SubHist sub, const unsigned char *fold, int csens,
+                          const unsigned char *buf, size_t len)
+{
+    (void) fold;
+    const __m128i sink = _mm_set1_epi8((char) HIST_SINK);
+    const __m128i lo = _mm_set1_epi8('a' - 1);
+    const __m128i hi = _mm_set1_epi8('z' + 1);
+    const __m128i delta = _mm_set1_epi8('a' - 'A');
+
+    size_t i;
+    for (i = 0; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (buf + i));
+        v = _mm_min_epu8(v, sink);
+        if (!csens) {
+            __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi));
+            v = _mm_sub_epi8(v, _mm_and_si128(lower, delta));
+        }
+        scatter(sub, _mm_cvtsi128_si64(v));
+        scatter(sub, _mm_cvtsi128_si64(_mm_unpackhi_epi64(v, v)));
+    }
+    return i;
+}
+
+/** @brief AVX2 kernel: same as the SSE2 one, 32 bytes at a time.
+ * @return Number of bytes counted (a multiple of 32)
+ */
+__attribute__((target("avx2")))
+static size_t kernel_avx2(SubHist sub, const unsigned char *fold, int csens,
+                          const unsigned char *buf, size_t len)
+{
+    (void) fold;
+    const __m256i sink = _mm256_set1_epi8((char) HIST_SINK);
+    const __m256i lo = _mm256_set1_epi8('a' - 1);
+    const __m256i hi = _mm256_set1_epi8('z' + 1);
+    const __m256i delta = _mm256_set1_epi8('a' - 'A');
+
+    size_t i;
+    for (i = 0; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (buf + i));
+        v = _mm256_min_epu8(v, sink);
+        if (!csens) {
+            __m256i lower = _mm256_and_si256(_mm256_cmpgt_epi8(v, lo), _mm256_cmpgt_epi8(hi, v));
+            v = _mm256_sub_epi8(v, _mm256_and_si256(lower, delta));
+        }
+        __m128i v0 = _mm256_castsi256_si128(v);
+        __m128i v1 = _mm256_extracti128_si256(v, 1);
+        scatter(sub, _mm_cvtsi128_si64(v0));
+        scatter(sub, _mm_cvtsi128_si64(_mm_unpackhi_epi64(v0, v0)));
+        scatter(sub, _mm_cvtsi128_si64(v1));
+        scatter(sub, _mm_cvtsi128_si64(_mm_unpackhi_epi64(v1, v1)));
+    }
+    return i;
+}
+#endif
@@ -0,0 +1,15 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stddef.h>
+
+// Number of slots in a histogram (ASCII plus one sink slot for the rest)
+#define HIST_SLOTS 129
+
+void hist_count(int *counts, const unsigned char *fold, int case_sensitive,
+                const unsigned char *buf, size_t len);
+
+const char *hist_kernel_name(void);
+int hist_select(const char *name);
+
+#endif
@@ -2,35 +2,261 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <unistd.h>
 #include "charstats.h"
 #include "strutils.h"
+#include "batch.h"
+#include "ngram.h"
+#include "mapping.h"
+#include "sidecar.h"
+#include "compact.h"
+#include "prefix.h"
 
 #define TOP_N 10
 #define TOP_FREQ_N 5
 
+#define USAGE "Usage: %s [-u|-U] [-i] [-j threads] [-g 2|3] <file>\n" \
+              "       %s [-j threads] -w width[:stride] <file>\n" \
+              "       %s [-u|-U] [-j threads] [-l listfile|-] [file...]\n"
+
+
+static int print_windows(char *path, const char *spec, int nthreads);
+static size_t parse_size(const char *str, char **end);
+static int count_file(char *path, CompactStats *cs, NGramStats *ng, int nthreads);
+static void print_stats(const CompactStats *cs);
+static void print_ngrams(NGramStats *ng, int order);
+static void report_file(const char *path, const CompactStats *stats, void *arg);
+
 
 int main(int argc, char **argv)
 {
-    if (argc != 2) {
-        fprintf(stderr, "%s requires exactly 1 argument (%d provided)\n", argv[0], argc - 1);
+    int nthreads = 0;
+    char *listpath = NULL;
+    int utf8 = CSTATS_ASCII;
+    int order = 0;
+    int indexed = 0;
+    char *windows = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:l:uUg:iw:")) != -1) {
+        switch (opt) {
+        case 'j':  nthreads = atoi(optarg);  break;
+        case 'l':  listpath = optarg;  break;
+        case 'u':  utf8 = CSTATS_UTF8;  break;
+        case 'U':  utf8 = CSTATS_UTF8_BASE;  break;
+        case 'i':  indexed = 1;  break;
+        case 'w':  windows = optarg;  break;
+        case 'g':
+            order = atoi(optarg);
+            if (order == 2 || order == 3)  break;
+            fprintf(stderr, "Wrong n-gram order '%s' (2 or 3 expected)\n", optarg);
+            return 1;
+        default:
+            fprintf(stderr, USAGE, argv[0], argv[0], argv[0]);
+            return 1;
+        }
+    }
+    int nfiles = argc - optind;
+
+    // Window mode: statistics of every window of one file
+    if (windows != NULL) {
+        if (listpath != NULL || nfiles != 1 || utf8 != CSTATS_ASCII || order || indexed) {
+            fprintf(stderr, USAGE, argv[0], argv[0], argv[0]);
+            return 1;
+        }
+        return print_windows(argv[optind], windows, nthreads);
+    }
+
+    // Single file mode: one file, counted serially unless -j is given
+    if (listpath == NULL && nfiles == 1) {
+        CompactStats *cs = NULL;
+        NGramStats *ng = order ? ngram_init() : NULL;
+        int err;
+        if (indexed) { // Letters from the sidecar index, n-grams still need a read
+            cs = compact_init_indexed(argv[optind], 0, utf8, nthreads ? nthreads : 1, NULL);
+            err = cs == NULL;
+            if (!err && ng != NULL)  err = count_file(argv[optind], NULL, ng, nthreads ? nthreads : 1);
+        }
+        else {
+            cs = compact_init(0, utf8);
+            err = count_file(argv[optind], cs, ng, nthreads ? nthreads : 1);
+        }
+        if (!err) {
+            print_stats(cs);
+            if (ng != NULL)  print_ngrams(ng, order);
+        }
+
+        if (cs != NULL)  compact_free(cs);
+        if (ng != NULL)  ngram_free(ng);
+        return err;
+    }
+
+    if (listpath == NULL && nfiles == 0) {
+        fprintf(stderr, "%s requires at least 1 file (0 provided)\n", argv[0]);
+        fprintf(stderr, USAGE, argv[0], argv[0], argv[0]);
         return 1;
     }
 
-    CharStats *stats = cstats_init_path(argv[1], 0);
+    // Batch mode: the files in the arguments, plus the ones in the list
+    int npaths = 0;
+    char **paths = NULL;
+    if (listpath != NULL) {
+        FILE *fp = strcmp(listpath, "-") == 0 ? stdin : fopen(listpath, "r");
+        if (fp == NULL) {
+            fprintf(stderr, "Error opening list file '%s'\n", listpath);
+            return 1;
+        }
+        paths = batch_read_list(fp, &npaths);
+        if (fp != stdin)  fclose(fp);
+    }
+    paths = realloc(paths, (npaths + nfiles) * sizeof(char *));
+    for (int i = 0; i < nfiles; i++)  paths[npaths++] = strdup(argv[optind + i]);
+
+    int nfailed;
+    CompactStats *total = batch_run(paths, npaths, 0, utf8, nthreads, report_file, NULL, &nfailed);
 
-    int total = stats->sum(stats, ALPHABET, ALPHABET_N);
+    printf("== %d files (%d failed) ==\n", npaths, nfailed);
+    print_stats(total);
 
-    printf("Total number of letters: %d\n", total);
-    char *top_10 = stats->get_top_n_coll(stats, TOP_N, ALPHABET, ALPHABET_N);
+    compact_free(total);
+    batch_free_list(paths, npaths);
+
+    return nfailed ? 1 : 0;
+}
+
+
+/** @brief Prints a one-line summary of every window of a file.
+ * @param path Path of the file
+ * @param spec Window size, optionally followed by `:` and the stride (the
+ *             size by default). Sizes take an optional K, M or G suffix.
+ * @param nthreads Number of threads to build the index with
+ * @return 0 if the file was indexed, 1 otherwise
+ */
+static int print_windows(char *path, const char *spec, int nthreads)
+{
+    char *end;
+    size_t width = parse_size(spec, &end);
+    size_t stride = *end == ':' ? parse_size(end + 1, &end) : width;
+    if (width == 0 || stride == 0 || *end != '\0') {
+        fprintf(stderr, "Wrong window '%s' (width[:stride] expected)\n", spec);
+        return 1;
+    }
+
+    PrefixIndex *idx = prefix_open(path, 0, PREFIX_STEP, nthreads);
+    if (idx == NULL)  return 1;
+
+    PrefixWindow win;
+    prefix_window_init(&win, idx, width, stride);
+    while (prefix_window_next(&win)) {
+        char top_10[TOP_N+1];
+        compact_top_n_into(win.stats, TOP_N, ALPHABET, ALPHABET_N, top_10);
+        printf("%zu-%zu: %llu letters, sorted: %s\n", win.start, win.end,
+               (unsigned long long) compact_sum(win.stats, ALPHABET, ALPHABET_N), top_10);
+    }
+    prefix_window_free(&win);
+    prefix_close(idx);
+    return 0;
+}
+
+/** @brief Parses a size in bytes, with an optional K, M or G suffix.
+ * @param str String to parse
+ * @param end Set to the first character after the size
+ * @return The size, or 0 if there is none
+ */
+static size_t parse_size(const char *str, char **end)
+{
+    if (!isdigit((unsigned char) *str)) {
+        *end = (char *) str;
+        return 0;
+    }
+    size_t size = strtoull(str, end, 10);
+    switch (**end) {
+    case 'K':  size <<= 10;  (*end)++;  break;
+    case 'M':  size <<= 20;  (*end)++;  break;
+    case 'G':  size <<= 30;  (*end)++;  break;
+    }
+    return size;
+}
+
+/** @brief Counts the letters, and optionally the n-grams, of a file in one read.
+ * @param path Path of the file
+ * @param cs Letter statistics to count into, or NULL
+ * @param ng N-gram statistics to count into, or NULL
+ * @param nthreads Number of threads to count with
+ * @return 0 if the file was counted, 1 if it couldn't be opened
+ */
+static int count_file(char *path, CompactStats *cs, NGramStats *ng, int nthreads)
+{
+    Mapping map;
+    if (map_open(&map, path))  return 1;
+
+    if (map.data != NULL) {
+        if (cs != NULL)  compact_count_buf(cs, map.data, map.len, nthreads);
+        if (ng != NULL)  ngram_count_buf(ng, map.data, map.len, nthreads);
+    }
+    else { // A stream can only be read once, so feed both as it goes
+        CharStats *scratch = cs != NULL ? compact_scratch(cs) : NULL;
+        char *buf = malloc(CSTATS_BLOCK_SIZE);
+        size_t nread;
+        while ((nread = fread(buf, 1, CSTATS_BLOCK_SIZE, map.fp)) > 0) {
+            if (cs != NULL)  compact_feed(cs, scratch, buf, nread, 1);
+            if (ng != NULL)  ngram_update(ng, buf, nread);
+        }
+        free(buf);
+        if (scratch != NULL)  scratch->free(scratch);
+    }
+
+    map_close(&map);
+    return 0;
+}
+
+/** @brief Prints the letter count, the top letters and their frequencies.
+ * @param cs Statistics to print
+ */
+static void print_stats(const CompactStats *cs)
+{
+    unsigned long long total = compact_sum(cs, ALPHABET, ALPHABET_N);
+
+    printf("Total number of letters: %llu\n", total);
+    if (cs->utf8 == CSTATS_UTF8)  printf("Letter \u00d1: %llu\n", (unsigned long long) cs->counts[CSTATS_ENYE]);
+    char top_10[TOP_N+1];
+    compact_top_n_into(cs, TOP_N, ALPHABET, ALPHABET_N, top_10);
     printf("Letters sorted by frequency: %s\n", top_10);
     printf("Most frequent letters: \n");
     for (int i = 0; i < TOP_FREQ_N; i++) {
-        printf("%c: %5.2f %% (%d/%d)\n",
-        top_10[i], 100.0*stats->get_freq(stats, top_10[i]), stats->get_count(stats, top_10[i]), total);
+        printf("%c: %5.2f %% (%llu/%llu)\n", top_10[i], 100.0*compact_get_freq(cs, top_10[i]),
+               (unsigned long long) compact_get_count(cs, top_10[i]), total);
     }
+}
 
-    stats->free(stats);
-    free(top_10);
+/** @brief Prints the most frequent n-grams of an order and their counts.
+ * @param ng N-gram statistics to print
+ * @param order 2 for bigrams, 3 for trigrams
+ */
+static void print_ngrams(NGramStats *ng, int order)
+{
+    int top[TOP_N];
+    int n = ngram_top_n(ng, order, TOP_N, top);
+    printf("Most frequent %s:", order == 2 ? "bigrams" : "trigrams");
+    for (int i = 0; i < n; i++) {
+        char gram[4];
+        ngram_name(order, top[i], gram);
+        printf(" %s(%llu)", gram, ngram_get_count(ng, gram));
+    }
+    printf("\n");
+}
 
-    return 0;
+/** @brief Prints a one-line summary of a file counted in batch mode.
+ * @param path Path of the file
+ * @param stats Statistics of the file, or NULL if it couldn't be read
+ * @param arg Unused
+ */
+static void report_file(const char *path, const CompactStats *stats, void *arg)
+{
+    (void) arg;
+    if (stats == NULL)  return; // Already reported on stderr
+
+    unsigned long long total = compact_sum(stats, ALPHABET, ALPHABET_N);
+    char top_10[TOP_N+1];
+    compact_top_n_into(stats, TOP_N, ALPHABET, ALPHABET_N, top_10);
+    printf("%s: %llu letters, sorted: %s\n", path, total, top_10);
 }
@@ -0,0 +1,60 @@
+#include "mapping.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+/** @brief Opens a file specified by a path and maps it into memory.
+ *
+ * Regular files are mapped read-only, and the mapping is advised as sequential
+ * so the kernel reads ahead aggressively. Files that can't be mapped (pipes,
+ * character devices, empty or special files) are opened as a stream instead,
+ * in `map->fp`.
+ *
+ * @param map Mapping to fill.
+ * @param path The path to the file to open.
+ * @return 0 if the file was opened, 1 if it could not be opened.
+ */
+int map_open(Mapping *map, char *path)
+{
+    map->data = NULL;
+    map->len = 0;
+    map->fp = NULL;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "Error opening file '%s'\n", path);
+        return 1;
+    }
+
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+
+    if (data == MAP_FAILED) { // Not mappable, use the stream path
+        map->fp = fdopen(fd, "r");
+        if (map->fp == NULL) {
+            fprintf(stderr, "Error opening file '%s'\n", path);
+            close(fd);
+            return 1;
+        }
+        return 0;
+    }
+    close(fd);
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    map->data = data;
+    map->len = st.st_size;
+    return 0;
+}
+
+/** @brief Unmaps or closes a file opened by `map_open`. */
+void map_close(Mapping *map)
+{
+    if (map->data != NULL)  munmap((void *) map->data, map->len);
+    if (map->fp != NULL)  fclose(map->fp);
+    map->data = NULL;
+    map->fp = NULL;
+}
@@ -0,0 +1,19 @@
+#ifndef MAPPING_H
+#define MAPPING_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+// A file opened for reading, either mapped into memory or as a stream
+typedef struct mapping {
+    // Contents of the file, or NULL if it couldn't be mapped
+    const unsigned char *data;
+    size_t len;
+    // Stream to read the file from if it couldn't be mapped, NULL otherwise
+    FILE *fp;
+} Mapping;
+
+int map_open(Mapping *map, char *path);
+void map_close(Mapping *map);
+
+#endif
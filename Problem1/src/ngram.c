@@ -0,0 +1,258 @@
+#include "ngram.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "mapping.h"
+
+// Size of a cache line, the alignment of the tables
+#define CACHE_LINE 64
+
+// Work unit for the parallel counting path
+typedef struct ngram_task {
+    // Private tables of the thread
+    NGramStats *local;
+    // Chunk of the file to count
+    const unsigned char *buf;
+    size_t len;
+    pthread_t thread;
+    int threaded;
+} NGramTask;
+
+static void ngram_count_parallel(NGramStats *ng, const unsigned char *buf, size_t len, int nthreads);
+static void *ngram_worker(void *task_ptr);
+static int ngram_valid(int order, int idx);
+
+
+/** @brief Initializes a new, empty NGramStats object.
+ *
+ * The tables are allocated along with the object, aligned to a cache line.
+ * Letters are counted case-insensitively, and every byte that is not a letter
+ * of `ALPHABET` acts as a boundary: n-grams never span across it.
+ *
+ * @return A pointer to the newly created NGramStats object.
+ */
+NGramStats *ngram_init(void)
+{
+    size_t size = (sizeof(NGramStats) + CACHE_LINE-1) / CACHE_LINE * CACHE_LINE;
+    NGramStats *ng = aligned_alloc(CACHE_LINE, size);
+    memset(ng, 0, sizeof(NGramStats));
+
+    memset(ng->symbol, NGRAM_BOUNDARY, sizeof(ng->symbol));
+    for (int i = 0; i < ALPHABET_N; i++) {
+        ng->symbol[(unsigned char) ALPHABET[i]] = i;
+        ng->symbol[tolower(ALPHABET[i])] = i;
+    }
+    ng->prev1 = ng->prev2 = NGRAM_BOUNDARY;
+    return ng;
+}
+
+/** @brief Frees an NGramStats object. */
+void ngram_free(NGramStats *ng)
+{
+    free(ng);
+}
+
+
+/** @brief Counts a chunk of data into an NGramStats object.
+ *
+ * Every byte increments one bigram and one trigram entry, with no branches:
+ * n-grams that include a boundary are counted too, and ignored on queries.
+ * The last two symbols are kept, so n-grams that span two chunks are counted
+ * as if the data had been given in one piece.
+ *
+ * @param ng A pointer to the NGramStats object to count into.
+ * @param buf The chunk of data to count.
+ * @param len The number of bytes in the chunk.
+ */
+void ngram_update(NGramStats *ng, const void *buf, size_t len)
+{
+    const unsigned char *bytes = buf;
+    int p1 = ng->prev1, p2 = ng->prev2;
+    for (size_t i = 0; i < len; i++) {
+        int s = ng->symbol[bytes[i]];
+        ng->bi[p1*NGRAM_SYMBOLS + s]++;
+        ng->tri[(p2*NGRAM_SYMBOLS + p1)*NGRAM_SYMBOLS + s]++;
+        p2 = p1;  p1 = s;
+    }
+    ng->prev1 = p1;  ng->prev2 = p2;
+    ng->nbytes += len;
+}
+
+/** @brief Counts a file specified by a path into an NGramStats object.
+ *
+ * The file is read like in `cstats_count_path`: memory-mapped when possible,
+ * split into chunks counted on `nthreads` threads into private tables that are
+ * added up at the end. Each thread starts from the two bytes before its chunk,
+ * so the result is the same as with `ngram_update` over the whole file.
+ *
+ * @param ng A pointer to the NGramStats object to count into.
+ * @param path The path to the file to read.
+ * @param nthreads Number of threads to use. If 0 or less, one per online CPU.
+ * @return 0 if the file was counted, 1 if it could not be opened.
+ */
+int ngram_count_path(NGramStats *ng, char *path, int nthreads)
+{
+    Mapping map;
+    if (map_open(&map, path))  return 1;
+
+    if (map.data == NULL) {
+        unsigned char *buf = malloc(NGRAM_BLOCK_SIZE);
+        size_t nread;
+        while ((nread = fread(buf, 1, NGRAM_BLOCK_SIZE, map.fp)) > 0)  ngram_update(ng, buf, nread);
+        free(buf);
+    }
+    else  ngram_count_buf(ng, map.data, map.len, nthreads);
+
+    map_close(&map);
+    return 0;
+}
+/** @brief Counts a block of memory into an NGramStats object on several threads.
+ *
+ * Same as `ngram_update`, but the block is split into contiguous chunks
+ * counted in parallel (see `ngram_count_path`).
+ *
+ * @param ng A pointer to the NGramStats object to count into.
+ * @param buf The block of bytes to count.
+ * @param len The number of bytes in the block.
+ * @param nthreads Number of threads to use. If 0 or less, one per online CPU.
+ */
+void ngram_count_buf(NGramStats *ng, const void *buf, size_t len, int nthreads)
+{
+    if (nthreads <= 0)  nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if ((size_t) nthreads > len)  nthreads = len;
+
+    if (nthreads <= 1)  ngram_update(ng, buf, len);
+    else  ngram_count_parallel(ng, buf, len, nthreads);
+}
+
+/** @brief Counts a block of memory on several threads.
+ *
+ * @param ng A pointer to the NGramStats object to count into.
+ * @param buf The block of bytes to count.
+ * @param len The number of bytes in the block (at least `nthreads`).
+ * @param nthreads Number of threads to split the block between.
+ */
+static void ngram_count_parallel(NGramStats *ng, const unsigned char *buf, size_t len, int nthreads)
+{
+    NGramTask *tasks = calloc(nthreads, sizeof(NGramTask));
+    size_t chunk = len / nthreads;
+    for (int t = 0; t < nthreads; t++) {
+        size_t start = t*chunk;
+        tasks[t].buf = buf + start;
+        tasks[t].len = (t == nthreads-1) ? len - start : chunk;
+
+        // Start from the two symbols before the chunk
+        NGramStats *local = tasks[t].local = ngram_init();
+        local->prev1 = start >= 1 ? ng->symbol[buf[start-1]] : ng->prev1;
+        local->prev2 = start >= 2 ? ng->symbol[buf[start-2]] : start == 1 ? ng->prev1 : ng->prev2;
+
+        // If the thread can't be created, count the chunk here instead
+        tasks[t].threaded = pthread_create(&tasks[t].thread, NULL, ngram_worker, &tasks[t]) == 0;
+        if (!tasks[t].threaded)  ngram_worker(&tasks[t]);
+    }
+    for (int t = 0; t < nthreads; t++) {
+        NGramStats *local = tasks[t].local;
+        if (tasks[t].threaded)  pthread_join(tasks[t].thread, NULL);
+        for (int i = 0; i < NGRAM_BI_N; i++)  ng->bi[i] += local->bi[i];
+        for (int i = 0; i < NGRAM_TRI_N; i++)  ng->tri[i] += local->tri[i];
+        if (t == nthreads-1) {
+            ng->prev1 = local->prev1;
+            ng->prev2 = local->prev2;
+        }
+        ngram_free(local);
+    }
+    free(tasks);
+    ng->nbytes += len;
+}
+
+/** @brief Thread body for the parallel counting path.
+ * @param task_ptr Pointer to the `NGramTask` to count
+ * @return NULL
+ */
+static void *ngram_worker(void *task_ptr)
+{
+    NGramTask *task = task_ptr;
+    ngram_update(task->local, task->buf, task->len);
+    return NULL;
+}
+
+
+/** @brief Gets the count of a bigram or trigram.
+ * @param ng A pointer to the NGramStats object.
+ * @param gram The n-gram, as a string of 2 or 3 letters (any case).
+ * @return The count, or 0 if `gram` is not a valid n-gram.
+ */
+unsigned long long ngram_get_count(NGramStats *ng, const char *gram)
+{
+    int len = strlen(gram);
+    if (len < 2 || len > 3)  return 0;
+    int idx = 0;
+    for (int i = 0; i < len; i++) {
+        int s = ng->symbol[(unsigned char) gram[i]];
+        if (s == NGRAM_BOUNDARY)  return 0;
+        idx = idx*NGRAM_SYMBOLS + s;
+    }
+    return len == 2 ? ng->bi[idx] : ng->tri[idx];
+}
+
+/** @brief Writes the indexes of the most frequent n-grams into caller-provided storage.
+ *
+ * Selects the `n` n-grams of the given order with the highest counts, in
+ * descending order of count. N-grams with the same count are ordered by their
+ * letters, and n-grams never seen are left out. Like `cstats_top_n_into`, it
+ * keeps a sorted window of the best `n` entries and allocates nothing.
+ *
+ * @param ng A pointer to the NGramStats object.
+ * @param order 2 for bigrams, 3 for trigrams.
+ * @param n Number of n-grams to select.
+ * @param out Buffer for the indexes, with room for `n` of them. Use
+ *            `ngram_name` to turn them into letters.
+ * @return The number of indexes written to `out` (0 if `n` is 0 or less).
+ */
+int ngram_top_n(NGramStats *ng, int order, int n, int *out)
+{
+    if (n <= 0)  return 0;
+    const unsigned long long *table = order == 2 ? ng->bi : ng->tri;
+    int size = order == 2 ? NGRAM_BI_N : NGRAM_TRI_N;
+
+    int len = 0;
+    for (int idx = 0; idx < size; idx++) {
+        unsigned long long count = table[idx];
+        if (count == 0 || (len == n && count <= table[out[n-1]]))  continue;
+        if (!ngram_valid(order, idx))  continue;
+
+        // Indexes grow, so an equal count ranks after the ones already kept
+        int j = len;
+        while (j > 0 && count > table[out[j-1]])  j--;
+        if (len < n)  len++;
+        memmove(out + j + 1, out + j, (len - 1 - j) * sizeof(int));
+        out[j] = idx;
+    }
+    return len;
+}
+
+/** @brief Writes the letters of an n-gram index.
+ * @param order 2 for bigrams, 3 for trigrams.
+ * @param idx Index of the n-gram in its table.
+ * @param gram Buffer for the letters, with room for `order`+1 characters.
+ */
+void ngram_name(int order, int idx, char *gram)
+{
+    for (int i = order-1; i >= 0; i--) {
+        gram[i] = ALPHABET[idx % NGRAM_SYMBOLS];
+        idx /= NGRAM_SYMBOLS;
+    }
+    gram[order] = '\0';
+}
+
+/** @brief Whether every symbol of an n-gram index is a letter. */
+static int ngram_valid(int order, int idx)
+{
+    for (int i = 0; i < order; i++) {
+        if (idx % NGRAM_SYMBOLS == NGRAM_BOUNDARY)  return 0;
+        idx /= NGRAM_SYMBOLS;
+    }
+    return 1;
+}
@@ -0,0 +1,40 @@
+#ifndef NGRAM_H
+#define NGRAM_H
+
+#include <stddef.h>
+#include "strutils.h"
+
+// Symbols of the n-gram tables: the letters, plus a boundary for anything else
+#define NGRAM_BOUNDARY ALPHABET_N
+#define NGRAM_SYMBOLS (ALPHABET_N+1)
+// Size of the blocks read at once when counting from a stream
+#define NGRAM_BLOCK_SIZE (64*1024)
+// Number of entries of the bigram and trigram tables
+#define NGRAM_BI_N (NGRAM_SYMBOLS*NGRAM_SYMBOLS)
+#define NGRAM_TRI_N (NGRAM_SYMBOLS*NGRAM_SYMBOLS*NGRAM_SYMBOLS)
+
+typedef struct ngram_stats {
+    // Counts of each bigram and trigram, indexed by their symbols in base
+    // NGRAM_SYMBOLS (first symbol most significant)
+    unsigned long long bi[NGRAM_BI_N];
+    unsigned long long tri[NGRAM_TRI_N];
+    // Byte to symbol lookup table
+    unsigned char symbol[256];
+    // Last two symbols counted, carried over between chunks
+    int prev1, prev2;
+    // Number of bytes counted so far
+    long long nbytes;
+} NGramStats;
+
+NGramStats *ngram_init(void);
+void ngram_free(NGramStats *ng);
+
+void ngram_update(NGramStats *ng, const void *buf, size_t len);
+int ngram_count_path(NGramStats *ng, char *path, int nthreads);
+void ngram_count_buf(NGramStats *ng, const void *buf, size_t len, int nthreads);
+
+unsigned long long ngram_get_count(NGramStats *ng, const char *gram);
+int ngram_top_n(NGramStats *ng, int order, int n, int *out);
+void ngram_name(int order, int idx, char *gram);
+
+#endif
@@ -0,0 +1,247 @@
+#include "prefix.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "histogram.h"
+#include "strutils.h"
+
+// Work unit for building the checkpoints: a run of consecutive steps
+typedef struct prefix_task {
+    PrefixIndex *idx;
+    size_t first;
+    size_t last;
+    pthread_t thread;
+    int threaded;
+} PrefixTask;
+
+static void *prefix_worker(void *task_ptr);
+static void count_bytes(const PrefixIndex *idx, size_t a, size_t b, uint64_t *counts);
+static void slide_bytes(const PrefixIndex *idx, size_t a, size_t b, uint64_t *counts, int add);
+
+
+/** @brief Maps a file and builds its prefix index in one pass.
+ *
+ * The file is split in steps of `step` bytes, and the letters of each step
+ * are counted (on `nthreads` threads, each taking a contiguous run of steps).
+ * A running sum over the steps then turns them into cumulative counts. Only
+ * the ASCII counting mode is supported: a byte range has no well defined
+ * UTF-8 counts when it cuts a sequence. Each checkpoint keeps the letters
+ * only, so the index takes 26 (52 if case-sensitive) 64-bit counts per step.
+ *
+ * @param path Path of the file to index.
+ * @param case_sensitive Whether lowercase letters are counted on their own.
+ * @param step Bytes between checkpoints. 0 for `PREFIX_STEP`, at most `PREFIX_STEP_MAX`.
+ * @param nthreads Number of threads to use. If 0 or less, one per online CPU.
+ * @return The new index, or NULL if the file couldn't be opened or mapped.
+ */
+PrefixIndex *prefix_open(char *path, int case_sensitive, size_t step, int nthreads)
+{
+    PrefixIndex *idx = calloc(1, sizeof(PrefixIndex));
+    if (map_open(&idx->map, path)) {
+        free(idx);
+        return NULL;
+    }
+    if (idx->map.data == NULL) {
+        fprintf(stderr, "Error indexing file '%s' (it can't be mapped)\n", path);
+        map_close(&idx->map);
+        free(idx);
+        return NULL;
+    }
+
+    idx->csens = case_sensitive;
+    for (int c = 0; c < 256; c++) {
+        if (c >= ASCII_N)  idx->fold[c] = CSTATS_SINK;
+        else  idx->fold[c] = case_sensitive ? (unsigned char) c : (unsigned char) toupper(c);
+    }
+    for (int i = 0; i < ALPHABET_N; i++)  idx->letters[idx->nletters++] = ALPHABET[i];
+    if (case_sensitive) {
+        for (int i = 0; i < ALPHABET_N; i++)  idx->letters[idx->nletters++] = tolower(ALPHABET[i]);
+    }
+    idx->step = step == 0 ? PREFIX_STEP : step < PREFIX_STEP_MAX ? step : PREFIX_STEP_MAX;
+    size_t nsteps = (idx->map.len + idx->step-1) / idx->step;
+    idx->ncheck = nsteps + 1;
+    idx->cum = calloc(idx->ncheck * idx->nletters, sizeof(uint64_t));
+
+    // Counts of each step, into the row after it
+    if (nthreads <= 0)  nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if ((size_t) nthreads > nsteps)  nthreads = nsteps;
+    if (nthreads < 1)  nthreads = 1;
+    PrefixTask *tasks = calloc(nthreads, sizeof(PrefixTask));
+    for (int t = 0; t < nthreads; t++) {
+        tasks[t].idx = idx;
+        tasks[t].first = nsteps * t / nthreads;
+        tasks[t].last = nsteps * (t+1) / nthreads;
+        tasks[t].threaded = t > 0 && pthread_create(&tasks[t].thread, NULL, prefix_worker, &tasks[t]) == 0;
+        if (t > 0 && !tasks[t].threaded)  prefix_worker(&tasks[t]);
+    }
+    prefix_worker(&tasks[0]);
+    for (int t = 1; t < nthreads; t++) {
+        if (tasks[t].threaded)  pthread_join(tasks[t].thread, NULL);
+    }
+    free(tasks);
+
+    // Running sum
+    for (size_t k = 1; k < idx->ncheck; k++) {
+        uint64_t *row = idx->cum + k * idx->nletters;
+        const uint64_t *prev = row - idx->nletters;
+        for (int i = 0; i < idx->nletters; i++)  row[i] += prev[i];
+    }
+    return idx;
+}
+
+/** @brief Unmaps the file of a prefix index and frees it. */
+void prefix_close(PrefixIndex *idx)
+{
+    map_close(&idx->map);
+    free(idx->cum);
+    free(idx);
+}
+
+/** @brief Thread body for `prefix_open`: counts a run of steps.
+ * @param task_ptr Pointer to the `PrefixTask` to count
+ * @return NULL
+ */
+static void *prefix_worker(void *task_ptr)
+{
+    PrefixTask *task = task_ptr;
+    PrefixIndex *idx = task->idx;
+    uint64_t counts[CSTATS_SLOTS];
+    for (size_t k = task->first; k < task->last; k++) {
+        size_t end = (k+1) * idx->step < idx->map.len ? (k+1) * idx->step : idx->map.len;
+        memset(counts, 0, sizeof(counts));
+        count_bytes(idx, k * idx->step, end, counts);
+        uint64_t *row = idx->cum + (k+1) * idx->nletters;
+        for (int i = 0; i < idx->nletters; i++)  row[i] = counts[idx->letters[i]];
+    }
+    return NULL;
+}
+
+
+/** @brief Gets the letter counts of a byte range of the indexed file.
+ *
+ * The counts of the whole steps inside the range are the difference of two
+ * checkpoints, which takes O(`ALPHABET_N`) no matter how long the range is.
+ * The bytes before the first and after the last checkpoint in the range (less
+ * than a step at each end) are counted from the mapping.
+ *
+ * @param idx Prefix index of the file.
+ * @param a Start of the range (included).
+ * @param b End of the range (excluded). Clamped to the size of the file.
+ * @param out Object to write the counts to. Its previous counts are replaced,
+ *            and only its letter slots are counted.
+ */
+void prefix_range(const PrefixIndex *idx, size_t a, size_t b, CompactStats *out)
+{
+    if (b > idx->map.len)  b = idx->map.len;
+    if (a > b)  a = b;
+    memset(out->counts, 0, sizeof(out->counts));
+    out->nbytes = b - a;
+    out->csens = idx->csens;
+    out->utf8 = CSTATS_ASCII;
+
+    size_t ka = (a + idx->step-1) / idx->step; // First checkpoint at or after a
+    size_t kb = b / idx->step;                 // Last checkpoint at or before b
+    if (ka >= kb) { // No whole step inside, it's a short range
+        count_bytes(idx, a, b, out->counts);
+        return;
+    }
+
+    const uint64_t *hi = idx->cum + kb * idx->nletters;
+    const uint64_t *lo = idx->cum + ka * idx->nletters;
+    for (int i = 0; i < idx->nletters; i++)  out->counts[idx->letters[i]] = hi[i] - lo[i];
+    count_bytes(idx, a, ka * idx->step, out->counts);
+    count_bytes(idx, kb * idx->step, b, out->counts);
+}
+
+/** @brief Adds the letter counts of the bytes [a, b) of the mapping to a 64-bit table.
+ *
+ * The range must be at most `PREFIX_STEP_MAX` bytes long.
+ */
+static void count_bytes(const PrefixIndex *idx, size_t a, size_t b, uint64_t *counts)
+{
+    if (a >= b)  return;
+    int part[HIST_SLOTS] = { 0 };
+    hist_count(part, idx->fold, idx->csens, idx->map.data + a, b - a);
+    for (int i = 0; i < idx->nletters; i++)  counts[idx->letters[i]] += part[idx->letters[i]];
+}
+
+/** @brief Adds or removes the letters of the bytes [a, b) of the mapping, one at a time.
+ *
+ * Meant for short ranges, where setting up a histogram costs more than it saves.
+ */
+static void slide_bytes(const PrefixIndex *idx, size_t a, size_t b, uint64_t *counts, int add)
+{
+    for (size_t i = a; i < b; i++) {
+        unsigned char c = idx->fold[idx->map.data[i]];
+        if (c >= ASCII_N || !isalpha(c))  continue;
+        if (add)  counts[c]++;
+        else  counts[c]--;
+    }
+}
+
+
+/** @brief Starts iterating over the windows of an indexed file.
+ *
+ * Windows are `width` bytes long and start every `stride` bytes: a stride
+ * equal to the width gives consecutive chunks, a smaller one a sliding window.
+ * The last window is cut at the end of the file, and the iteration stops
+ * after the first window that reaches it. Each window costs the same as a
+ * `prefix_range` call, whatever its width. If the stride is shorter than
+ * both the width and a step of the index, each window is instead obtained
+ * by sliding the previous one: the bytes it leaves are removed and the ones
+ * it reaches are added, which costs O(`stride`).
+ *
+ * @param win Iterator to initialize. Must be freed with `prefix_window_free`.
+ * @param idx Prefix index of the file.
+ * @param width Bytes per window (at least 1).
+ * @param stride Bytes between the starts of two windows (at least 1).
+ */
+void prefix_window_init(PrefixWindow *win, const PrefixIndex *idx, size_t width, size_t stride)
+{
+    win->idx = idx;
+    win->width = width > 0 ? width : 1;
+    win->stride = stride > 0 ? stride : 1;
+    win->start = 0;
+    win->end = 0;
+    win->slide = win->stride < idx->step && win->stride <= win->width;
+    win->stats = compact_init(idx->csens, CSTATS_ASCII);
+}
+
+/** @brief Moves to the next window and counts it into `win->stats`.
+ * @param win Iterator
+ * @return 1 if there was another window (in `win->start`, `win->end`), 0 at the end.
+ */
+int prefix_window_next(PrefixWindow *win)
+{
+    size_t len = win->idx->map.len;
+    if (win->end == 0) { // First window
+        if (len == 0)  return 0;
+        win->end = len > win->width ? win->width : len;
+        prefix_range(win->idx, 0, win->end, win->stats);
+        return 1;
+    }
+    if (win->end >= len || win->stride >= len - win->start)  return 0;
+
+    size_t start = win->start + win->stride;
+    size_t end = len - start > win->width ? start + win->width : len;
+    if (win->slide) {
+        slide_bytes(win->idx, win->start, start, win->stats->counts, 0);
+        slide_bytes(win->idx, win->end, end, win->stats->counts, 1);
+        win->stats->nbytes = end - start;
+    }
+    else {
+        prefix_range(win->idx, start, end, win->stats);
+    }
+    win->start = start;
+    win->end = end;
+    return 1;
+}
+
+/** @brief Frees the counts of a window iterator. */
+void prefix_window_free(PrefixWindow *win)
+{
+    compact_free(win->stats);
+    win->stats = NULL;
+}
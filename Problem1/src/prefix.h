@@ -0,0 +1,58 @@
+#ifndef PREFIX_H
+#define PREFIX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "compact.h"
+#include "mapping.h"
+#include "strutils.h"
+
+// Default number of bytes between two checkpoints of a prefix index
+#define PREFIX_STEP (64*1024)
+// Largest step allowed, so a step can be counted into int counters
+#define PREFIX_STEP_MAX ((size_t) 1 << 30)
+
+// Cumulative letter counts of a mapped file, taken every `step` bytes, so the
+// counts of any byte range are a subtraction of two checkpoints (plus the
+// partial steps at its ends, counted directly from the mapping). Only the
+// letters are indexed: other characters are never counted.
+typedef struct prefix_index {
+    Mapping map;
+    int csens;
+    unsigned char fold[256];
+    // Slots of the indexed letters (uppercase, then lowercase if
+    // case-sensitive), in the order of the columns of a checkpoint
+    unsigned char letters[2*ALPHABET_N];
+    int nletters;
+    // Bytes between checkpoints, and number of checkpoints (one per step,
+    // plus one for the start of the file)
+    size_t step;
+    size_t ncheck;
+    // Checkpoint k holds the counts of [0, k*step), `nletters` per row
+    uint64_t *cum;
+} PrefixIndex;
+
+// Iterator over the windows of a prefix index
+typedef struct prefix_window {
+    const PrefixIndex *idx;
+    size_t width;
+    size_t stride;
+    // Start and end of the current window
+    size_t start;
+    size_t end;
+    // Whether the next window is counted by sliding this one (see
+    // prefix_window_next) instead of from the checkpoints
+    int slide;
+    // Counts of the current window
+    CompactStats *stats;
+} PrefixWindow;
+
+PrefixIndex *prefix_open(char *path, int case_sensitive, size_t step, int nthreads);
+void prefix_close(PrefixIndex *idx);
+void prefix_range(const PrefixIndex *idx, size_t a, size_t b, CompactStats *out);
+
+void prefix_window_init(PrefixWindow *win, const PrefixIndex *idx, size_t width, size_t stride);
+int prefix_window_next(PrefixWindow *win);
+void prefix_window_free(PrefixWindow *win);
+
+#endif
@@ -0,0 +1,270 @@
+#include "sidecar.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "mapping.h"
+
+#define SIDECAR_MAGIC "CSTATS1"
+
+// Header of a sidecar index file. It is followed by the counts (CSTATS_SLOTS
+// 64-bit integers) and the block checksums (nblocks 64-bit integers).
+typedef struct sidecar_header {
+    char magic[8];
+    // Settings of the CharStats object the counts belong to
+    int32_t csens;
+    int32_t utf8;
+    int32_t slots;
+    int32_t block_size;
+    // State of the file when it was counted
+    int64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t nblocks;
+    // UTF-8 decoding state at the end of the file
+    uint8_t pending[4];
+    int32_t npending;
+    uint8_t prev;
+} SidecarHeader;
+
+// Contents of a sidecar index
+typedef struct sidecar {
+    SidecarHeader hdr;
+    int64_t counts[CSTATS_SLOTS];
+    uint64_t *sums;
+} Sidecar;
+
+static int sidecar_load(Sidecar *sc, const char *scpath, int csens, int utf8);
+static int sidecar_save(Sidecar *sc, const char *scpath);
+static uint64_t block_sum(const unsigned char *buf, size_t len);
+static int sums_match(const Sidecar *sc, const unsigned char *data);
+static void update_sums(Sidecar *sc, const unsigned char *data, size_t from, size_t to);
+
+
+/** @brief Initializes a new CompactStats object for a file, through its sidecar index.
+ *
+ * The counts of a file are saved next to it, in `<path>.cstats`, along with
+ * its size, modification time and a checksum of every `SIDECAR_BLOCK` bytes.
+ * On later calls:
+ * * if the file has the same size and modification time, the counts are
+ *   loaded without reading the file at all;
+ * * if the file only grew (like an append-only log), the checksums of all the
+ *   blocks of the old contents are verified (hashing is cheaper than
+ *   counting), and only the new tail is counted;
+ * * otherwise, or if the index is missing or was made with other settings,
+ *   the whole file is counted again.
+ * The index is then updated. Files that can't be mapped (pipes, devices) are
+ * counted normally and get no index.
+ *
+ * @param path The path to the file to read characters from.
+ * @param case_sensitive Whether the counts should be case-sensitive.
+ * @param utf8 Counting mode for non-ASCII input (see `cstats_set_utf8`).
+ * @param nthreads Number of threads to count with (see `cstats_count_path`).
+ * @param how If not NULL, set to `SIDECAR_HIT`, `SIDECAR_APPEND` or `SIDECAR_REBUILD`.
+ * @return A pointer to the newly created CompactStats object, or `NULL` if the file could not be opened.
+ */
+CompactStats *compact_init_indexed(char *path, int case_sensitive, int utf8, int nthreads, int *how)
+{
+    CompactStats *cs = compact_init(case_sensitive, utf8);
+    if (how != NULL)  *how = SIDECAR_REBUILD;
+
+    struct stat st;
+    if (stat(path, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        if (compact_count_path(cs, path, nthreads) == 0)  return cs;
+        compact_free(cs);
+        return NULL;
+    }
+
+    char *scpath = malloc(strlen(path) + sizeof(SIDECAR_SUFFIX));
+    strcat(strcpy(scpath, path), SIDECAR_SUFFIX);
+
+    Sidecar sc = { .sums = NULL };
+    int loaded = sidecar_load(&sc, scpath, case_sensitive, utf8) == 0;
+
+    // Unchanged file: no need to open it
+    if (loaded && sc.hdr.size == st.st_size && sc.hdr.mtime_sec == st.st_mtim.tv_sec
+               && sc.hdr.mtime_nsec == st.st_mtim.tv_nsec) {
+        for (int c = 0; c < CSTATS_SLOTS; c++)  cs->counts[c] = sc.counts[c];
+        cs->nbytes = sc.hdr.size;
+        if (how != NULL)  *how = SIDECAR_HIT;
+        free(sc.sums);
+        free(scpath);
+        return cs;
+    }
+
+    Mapping map;
+    if (map_open(&map, path)) {
+        compact_free(cs);
+        free(sc.sums);
+        free(scpath);
+        return NULL;
+    }
+    if (map.data == NULL) { // Changed under our feet, count it as a stream
+        map_close(&map);
+        free(sc.sums);
+        free(scpath);
+        if (compact_count_path(cs, path, nthreads) == 0)  return cs;
+        compact_free(cs);
+        return NULL;
+    }
+
+    // Grown file: the old contents must be the same they were. The scratch
+    // object carries the UTF-8 decoding state over from the index.
+    CharStats *scratch = compact_scratch(cs);
+    size_t from = 0;
+    if (loaded && sc.hdr.size > 0 && (size_t) sc.hdr.size < map.len) {
+        if (sums_match(&sc, map.data)) {
+            for (int c = 0; c < CSTATS_SLOTS; c++)  cs->counts[c] = sc.counts[c];
+            cs->nbytes = sc.hdr.size;
+            memcpy(scratch->_pending, sc.hdr.pending, sizeof(scratch->_pending));
+            scratch->_npending = sc.hdr.npending;
+            scratch->_prev = sc.hdr.prev;
+            from = sc.hdr.size;
+            if (how != NULL)  *how = SIDECAR_APPEND;
+        }
+    }
+    if (from == 0) {
+        sc.hdr.size = 0;
+        sc.hdr.nblocks = 0;
+    }
+
+    compact_feed(cs, scratch, map.data + from, map.len - from, nthreads);
+    update_sums(&sc, map.data, from, map.len);
+
+    // Save the new state of the file
+    memcpy(sc.hdr.magic, SIDECAR_MAGIC, sizeof(sc.hdr.magic));
+    sc.hdr.csens = case_sensitive;
+    sc.hdr.utf8 = utf8;
+    sc.hdr.slots = CSTATS_SLOTS;
+    sc.hdr.block_size = SIDECAR_BLOCK;
+    sc.hdr.size = map.len;
+    sc.hdr.mtime_sec = st.st_mtim.tv_sec;
+    sc.hdr.mtime_nsec = st.st_mtim.tv_nsec;
+    memcpy(sc.hdr.pending, scratch->_pending, sizeof(sc.hdr.pending));
+    sc.hdr.npending = scratch->_npending;
+    sc.hdr.prev = scratch->_prev;
+    for (int c = 0; c < CSTATS_SLOTS; c++)  sc.counts[c] = cs->counts[c];
+    if (sidecar_save(&sc, scpath)) {
+        fprintf(stderr, "Error saving index '%s'\n", scpath);
+    }
+
+    scratch->free(scratch);
+    map_close(&map);
+    free(sc.sums);
+    free(scpath);
+    return cs;
+}
+
+
+/** @brief Loads a sidecar index, if it exists and matches the given settings.
+ * @param sc Sidecar to fill. `sc->sums` must be freed by the caller.
+ * @param scpath Path of the sidecar file
+ * @param csens Case sensitivity the counts must have
+ * @param utf8 Counting mode the counts must have
+ * @return 0 if it was loaded, 1 otherwise
+ */
+static int sidecar_load(Sidecar *sc, const char *scpath, int csens, int utf8)
+{
+    FILE *fp = fopen(scpath, "rb");
+    if (fp == NULL)  return 1;
+
+    int ok = fread(&sc->hdr, sizeof(sc->hdr), 1, fp) == 1
+          && memcmp(sc->hdr.magic, SIDECAR_MAGIC, sizeof(sc->hdr.magic)) == 0
+          && sc->hdr.csens == csens && sc->hdr.utf8 == utf8
+          && sc->hdr.slots == CSTATS_SLOTS && sc->hdr.block_size == SIDECAR_BLOCK
+          && sc->hdr.nblocks == (sc->hdr.size + SIDECAR_BLOCK-1) / SIDECAR_BLOCK
+          && sc->hdr.npending >= 0 && sc->hdr.npending <= 3
+          && fread(sc->counts, sizeof(sc->counts), 1, fp) == 1;
+    if (ok) {
+        sc->sums = malloc((sc->hdr.nblocks + 1) * sizeof(uint64_t));
+        ok = fread(sc->sums, sizeof(uint64_t), sc->hdr.nblocks, fp) == (size_t) sc->hdr.nblocks;
+    }
+    fclose(fp);
+    return !ok;
+}
+
+/** @brief Saves a sidecar index, replacing the old one atomically.
+ * @param sc Sidecar to save
+ * @param scpath Path of the sidecar file
+ * @return 0 if it was saved, 1 otherwise
+ */
+static int sidecar_save(Sidecar *sc, const char *scpath)
+{
+    char *tmppath = malloc(strlen(scpath) + sizeof(".tmp"));
+    strcat(strcpy(tmppath, scpath), ".tmp");
+
+    FILE *fp = fopen(tmppath, "wb");
+    int ok = fp != NULL;
+    if (ok) {
+        ok = fwrite(&sc->hdr, sizeof(sc->hdr), 1, fp) == 1
+          && fwrite(sc->counts, sizeof(sc->counts), 1, fp) == 1
+          && fwrite(sc->sums, sizeof(uint64_t), sc->hdr.nblocks, fp) == (size_t) sc->hdr.nblocks;
+        ok = (fclose(fp) == 0) && ok;
+    }
+    ok = ok && rename(tmppath, scpath) == 0;
+    if (!ok)  remove(tmppath);
+
+    free(tmppath);
+    return !ok;
+}
+
+
+/** @brief Checks the checksums of a sidecar against the first bytes of a file.
+ * @param sc Sidecar with the checksums of the first `sc->hdr.size` bytes
+ * @param data Contents of the file, at least `sc->hdr.size` bytes long
+ * @return 1 if every block still has its checksum, 0 otherwise
+ */
+static int sums_match(const Sidecar *sc, const unsigned char *data)
+{
+    size_t size = sc->hdr.size;
+    for (int64_t b = 0; b < sc->hdr.nblocks; b++) {
+        size_t start = b * SIDECAR_BLOCK;
+        size_t end = start + SIDECAR_BLOCK < size ? start + SIDECAR_BLOCK : size;
+        if (block_sum(data + start, end - start) != sc->sums[b])  return 0;
+    }
+    return 1;
+}
+
+/** @brief Recomputes the checksums of the blocks touched by new data.
+ *
+ * The block that held the old end of the file is summed again over its new
+ * extent, and sums are added for the blocks after it.
+ *
+ * @param sc Sidecar with the checksums of the first `from` bytes
+ * @param data Contents of the file
+ * @param from Old size of the file (0 to sum everything)
+ * @param to New size of the file
+ */
+static void update_sums(Sidecar *sc, const unsigned char *data, size_t from, size_t to)
+{
+    size_t nblocks = (to + SIDECAR_BLOCK-1) / SIDECAR_BLOCK;
+    sc->sums = realloc(sc->sums, (nblocks + 1) * sizeof(uint64_t));
+    for (size_t b = from / SIDECAR_BLOCK; b < nblocks; b++) {
+        size_t start = b * SIDECAR_BLOCK;
+        size_t end = start + SIDECAR_BLOCK < to ? start + SIDECAR_BLOCK : to;
+        sc->sums[b] = block_sum(data + start, end - start);
+    }
+    sc->hdr.nblocks = nblocks;
+}
+
+/** @brief Computes the checksum of a block, 8 bytes at a time.
+ *
+ * A multiply-xorshift hash: not cryptographic, but any change to the block
+ * changes it with overwhelming probability.
+ */
+static uint64_t block_sum(const unsigned char *buf, size_t len)
+{
+    const uint64_t k = 0x9E3779B97F4A7C15ULL;
+    uint64_t h = len * k;
+    size_t i;
+    for (i = 0; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, buf + i, 8);
+        h = (h ^ w) * k;
+        h ^= h >> 32;
+    }
+    uint64_t w = 0;
+    memcpy(&w, buf + i, len - i);
+    h = (h ^ w) * k;
+    return h ^ (h >> 29);
+}
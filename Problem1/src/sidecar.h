@@ -0,0 +1,18 @@
+#ifndef SIDECAR_H
+#define SIDECAR_H
+
+#include "compact.h"
+
+// Suffix appended to a file's path to name its sidecar index
+#define SIDECAR_SUFFIX ".cstats"
+// Size of the blocks the index keeps a checksum of
+#define SIDECAR_BLOCK (1024*1024)
+
+// How a CompactStats object was obtained by compact_init_indexed
+#define SIDECAR_HIT 0      // Loaded from the index, the file was unchanged
+#define SIDECAR_APPEND 1   // Loaded from the index, the appended tail was counted
+#define SIDECAR_REBUILD 2  // Counted from scratch (no index, or the file changed)
+
+CompactStats *compact_init_indexed(char *path, int case_sensitive, int utf8, int nthreads, int *how);
+
+#endif
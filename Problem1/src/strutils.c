@@ -1,7 +1,31 @@
 #include "strutils.h"
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
+#include <pthread.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CASE_X86 1
+#endif
+
+// A case conversion kernel. It adds `delta` to the bytes from `first` to
+// `last` and copies the rest, and returns how many bytes it converted. The
+// tail is left to the scalar loop.
+typedef size_t (*CaseKernel)(char *dst, const char *src, size_t len,
+                             char first, char last, char delta);
+
+static size_t kernel_none(char *dst, const char *src, size_t len,
+                          char first, char last, char delta);
+#ifdef CASE_X86
+static size_t kernel_sse2(char *dst, const char *src, size_t len,
+                          char first, char last, char delta);
+static size_t kernel_avx2(char *dst, const char *src, size_t len,
+                          char first, char last, char delta);
+#endif
+
+static void case_convert(char *dst, const char *src, size_t len,
+                         char first, char last, char delta);
+static void case_resolve(void);
 
 const char ALPHABET[ALPHABET_N+1] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
 const char ASCII[ASCII_N+1] = "\x00\x01\x02\x03\x04\x05\x06\a""\b""\t""\n""\b""\f""\r""\x0e\x0f"
@@ -10,6 +34,10 @@ const char ASCII[ASCII_N+1] = "\x00\x01\x02\x03\x04\x05\x06\a""\b""\t""\n""\b""\
                               "@ABCDEFGHIJKLMNOPQRSTUVWXYZ[\\]^_"
                               "`abcdefghijklmnopqrstuvwxyz{|}~\x7f";
 
+// Kernel in use, resolved once on the first call
+static CaseKernel kernel = kernel_none;
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
 
 /**
  * @brief Converts a string to uppercase.
@@ -23,10 +51,9 @@ const char ASCII[ASCII_N+1] = "\x00\x01\x02\x03\x04\x05\x06\a""\b""\t""\n""\b""\
  */
 char *strupper(const char *str)
 {
-    char *upper = strdup(str);
-    for (int i=0; str[i] != '\0'; i++) {
-        upper[i] = toupper(str[i]);
-    }
+    size_t len = strlen(str);
+    char *upper = malloc(len + 1);
+    memupper(upper, str, len + 1);
     return upper;
 }
 
@@ -42,13 +69,41 @@ char *strupper(const char *str)
  */
 char *strlower(const char *str)
 {
-    char *lower = strdup(str);
-    for (int i=0; str[i] != '\0'; i++) {
-        lower[i] = tolower(str[i]);
-    }
+    size_t len = strlen(str);
+    char *lower = malloc(len + 1);
+    memlower(lower, str, len + 1);
     return lower;
 }
 
+/**
+ * @brief Converts a block of bytes to uppercase.
+ *
+ * Only ASCII letters are converted, as `toupper` does in the C locale. The
+ * block is read once, many bytes at a time with vector compares and adds.
+ *
+ * @param dst Where to write the converted bytes. It may be `src` itself.
+ * @param src The bytes to convert. They needn't be `'\0'`-terminated.
+ * @param len The number of bytes to convert.
+ */
+void memupper(char *dst, const char *src, size_t len)
+{
+    case_convert(dst, src, len, 'a', 'z', 'A' - 'a');
+}
+
+/**
+ * @brief Converts a block of bytes to lowercase.
+ *
+ * Same as `memupper`, the other way round.
+ *
+ * @param dst Where to write the converted bytes. It may be `src` itself.
+ * @param src The bytes to convert. They needn't be `'\0'`-terminated.
+ * @param len The number of bytes to convert.
+ */
+void memlower(char *dst, const char *src, size_t len)
+{
+    case_convert(dst, src, len, 'A', 'Z', 'a' - 'A');
+}
+
 
 /**
  * @brief Returns a slice of a string.
@@ -73,3 +128,87 @@ char *strslice(const char *source, int start, int end)
     slice[end - start] = '\0';
     return slice;
 }
+
+
+/** @brief Adds `delta` to the bytes from `first` to `last`, with the best kernel. */
+static void case_convert(char *dst, const char *src, size_t len,
+                         char first, char last, char delta)
+{
+    pthread_once(&kernel_once, case_resolve);
+    size_t done = kernel(dst, src, len, first, last, delta);
+    for (size_t i = done; i < len; i++) {
+        char c = src[i];
+        dst[i] = c >= first && c <= last ? c + delta : c;
+    }
+}
+
+/** @brief Picks the widest kernel this CPU supports (through CPUID). */
+static void case_resolve(void)
+{
+#ifdef CASE_X86
+    __builtin_cpu_init();
+    kernel = __builtin_cpu_supports("avx2") ? kernel_avx2 : kernel_sse2;
+#endif
+}
+
+/** @brief Portable kernel: leaves the whole block to the scalar loop. */
+static size_t kernel_none(char *dst, const char *src, size_t len,
+                          char first, char last, char delta)
+{
+    (void) dst;  (void) src;  (void) len;  (void) first;  (void) last;  (void) delta;
+    return 0;
+}
+
+#ifdef CASE_X86
+/** @brief SSE2 kernel: converts 16 bytes at a time.
+ *
+ * The range check is a pair of signed compares. Non-ASCII bytes are negative
+ * as signed bytes, so they never match and are copied as they are.
+ *
+ * @return Number of bytes converted (a multiple of 16)
+ */
+static size_t kernel_sse2(char *dst, const char *src, size_t len,
+                          char first, char last, char delta)
+{
+    const __m128i lo = _mm_set1_epi8(first - 1);
+    const __m128i hi = _mm_set1_epi8(last + 1);
+    const __m128i add = _mm_set1_epi8(delta);
+
+    size_t i;
+    for (i = 0; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i match = _mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi));
+        v = _mm_add_epi8(v, _mm_and_si128(match, add));
+        _mm_storeu_si128((__m128i *) (dst + i), v);
+    }
+    return i;
+}
+
+/** @brief AVX2 kernel: same as the SSE2 one, 64 bytes (two vectors) at a time.
+ * @return Number of bytes converted (a multiple of 32)
+ */
+__attribute__((target("avx2")))
+static size_t kernel_avx2(char *dst, const char *src, size_t len,
+                          char first, char last, char delta)
+{
+    const __m256i lo = _mm256_set1_epi8(first - 1);
+    const __m256i hi = _mm256_set1_epi8(last + 1);
+    const __m256i add = _mm256_set1_epi8(delta);
+
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *) (src + i));
+        __m256i v1 = _mm256_loadu_si256((const __m256i *) (src + i + 32));
+        __m256i m0 = _mm256_and_si256(_mm256_cmpgt_epi8(v0, lo), _mm256_cmpgt_epi8(hi, v0));
+        __m256i m1 = _mm256_and_si256(_mm256_cmpgt_epi8(v1, lo), _mm256_cmpgt_epi8(hi, v1));
+        _mm256_storeu_si256((__m256i *) (dst + i), _mm256_add_epi8(v0, _mm256_and_si256(m0, add)));
+        _mm256_storeu_si256((__m256i *) (dst + i + 32), _mm256_add_epi8(v1, _mm256_and_si256(m1, add)));
+    }
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (src + i));
+        __m256i match = _mm256_and_si256(_mm256_cmpgt_epi8(v, lo), _mm256_cmpgt_epi8(hi, v));
+        _mm256_storeu_si256((__m256i *) (dst + i), _mm256_add_epi8(v, _mm256_and_si256(match, add)));
+    }
+    return i;
+}
+#endif
@@ -1,6 +1,8 @@
 #ifndef STRUTILS_H
 #define STRUTILS_H
 
+#include <stddef.h>
+
 #define ASCII_N 128
 #define ALPHABET_N 26
 
@@ -10,6 +12,8 @@ extern const char ALPHABET[ALPHABET_N+1];
 
 char *strupper(const char *str);
 char *strlower(const char *str);
+void memupper(char *dst, const char *src, size_t len);
+void memlower(char *dst, const char *src, size_t len);
 
 char *strslice(const char *str, int start, int end);
 
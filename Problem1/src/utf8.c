@@ -0,0 +1,162 @@
+#include "utf8.h"
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include "histogram.h"
+
+// ASCII runs at least this long are counted by the histogram kernels
+#define UTF8_KERNEL_RUN 1024
+// High bit of every byte in a word
+#define UTF8_HIGH_BITS 0x8080808080808080ULL
+
+// Base letter of every code point from U+00C0 to U+00FF. '?' marks symbols
+// and letters without an ASCII base, '\1' and '\2' mark Ñ and ñ.
+static const char latin1_base[UTF8_LATIN1_N+1] =
+    "AAAAAA?CEEEEIIII?\1OOOOO?OUUUUY??"
+    "aaaaaa?ceeeeiiii?\2ooooo?ouuuuy?y";
+
+
+/** @brief Returns the length of the UTF-8 sequence started by a byte.
+ * @param lead First byte of the sequence
+ * @return 1 to 4, or 0 if the byte can't start a sequence
+ */
+int utf8_seq_len(unsigned char lead)
+{
+    if (lead < 0x80)  return 1;
+    if (lead < 0xC0)  return 0; // Continuation byte
+    if (lead < 0xE0)  return 2;
+    if (lead < 0xF0)  return 3;
+    if (lead < 0xF8)  return 4;
+    return 0;
+}
+
+/** @brief Decodes a complete UTF-8 sequence.
+ * @param seq The bytes of the sequence, already checked to be well formed
+ * @param n Length of the sequence, as given by `utf8_seq_len`
+ * @return The code point
+ */
+unsigned int utf8_decode(const unsigned char *seq, int n)
+{
+    static const unsigned char lead_mask[5] = { 0, 0x7F, 0x1F, 0x0F, 0x07 };
+    unsigned int cp = seq[0] & lead_mask[n];
+    for (int k = 1; k < n; k++)  cp = (cp << 6) | (seq[k] & 0x3F);
+    return cp;
+}
+
+/** @brief Builds the fold table for the Latin-1 letters.
+ *
+ * Maps every code point from `UTF8_LATIN1_FIRST` to its counts slot: accented
+ * letters to their base letter (uppercased if not `case_sensitive`), and
+ * symbols to the sink. Ñ gets its own slot in `CSTATS_UTF8` mode, and folds
+ * to N in `CSTATS_UTF8_BASE` mode.
+ *
+ * @param latin1 Table to fill, with `UTF8_LATIN1_N` entries
+ * @param case_sensitive Whether lowercase letters are counted on their own
+ * @param mode `CSTATS_UTF8` or `CSTATS_UTF8_BASE`
+ */
+void utf8_fold_table(unsigned char *latin1, int case_sensitive, int mode)
+{
+    for (int i = 0; i < UTF8_LATIN1_N; i++) {
+        char base = latin1_base[i];
+        if (base == '\1' || base == '\2') {
+            if (mode == CSTATS_UTF8_BASE)  base = base == '\1' ? 'N' : 'n';
+            else {
+                int lower = base == '\2' && case_sensitive;
+                latin1[i] = lower ? CSTATS_ENYE_LOWER : CSTATS_ENYE;
+                continue;
+            }
+        }
+        if (base == '?')  latin1[i] = CSTATS_SINK;
+        else  latin1[i] = case_sensitive ? base : toupper(base);
+    }
+}
+
+
+/** @brief Counts a block of UTF-8 text into a counts table.
+ *
+ * ASCII runs are found a word at a time and counted through the byte fold
+ * table (long ones by the histogram kernels). Other sequences are decoded and
+ * counted once per code point (see `utf8_count_cp`). Malformed sequences count
+ * once into the sink.
+ *
+ * A sequence cut by the end of the block is not counted: the number of bytes
+ * consumed is returned so the caller can keep the rest for the next block.
+ *
+ * @param counts The counts table to increment, with `CSTATS_SLOTS` slots.
+ * @param fold Byte fold table of the CharStats object.
+ * @param case_sensitive Case sensitivity of the CharStats object.
+ * @param latin1 Latin-1 fold table, as built by `utf8_fold_table`.
+ * @param prev The byte right before the block (0 if none).
+ * @param buf The block of text to count.
+ * @param len The number of bytes in the block.
+ * @return The number of bytes consumed (`len` minus at most 3).
+ */
+size_t utf8_count(int *counts, const unsigned char *fold, int case_sensitive,
+                  const unsigned char *latin1, unsigned char prev,
+                  const unsigned char *buf, size_t len)
+{
+    size_t i = 0;
+    while (i < len) {
+        // ASCII run fast path
+        size_t start = i;
+        while (i + 8 <= len) {
+            uint64_t w;
+            memcpy(&w, buf + i, 8);
+            if (w & UTF8_HIGH_BITS)  break;
+            i += 8;
+        }
+        while (i < len && buf[i] < 0x80)  i++;
+        if (i - start >= UTF8_KERNEL_RUN) {
+            hist_count(counts, fold, case_sensitive, buf + start, i - start);
+        }
+        else {
+            for (size_t k = start; k < i; k++)  counts[fold[buf[k]]]++;
+        }
+        if (i == len)  break;
+
+        // Multi-byte sequence
+        int n = utf8_seq_len(buf[i]);
+        if (n == 0) { // Stray continuation or invalid byte
+            counts[CSTATS_SINK]++;
+            i++;
+            continue;
+        }
+        int k;
+        for (k = 1; k < n && i + k < len; k++) {
+            if ((buf[i+k] & 0xC0) != 0x80)  break;
+        }
+        if (k < n) {
+            if (i + k == len)  return i; // Cut by the end of the block
+            counts[CSTATS_SINK]++; // Malformed, resume at the offending byte
+            i += k;
+            continue;
+        }
+
+        utf8_count_cp(counts, fold, latin1, i > 0 ? buf[i-1] : prev, utf8_decode(buf + i, n));
+        i += n;
+    }
+    return len;
+}
+
+/** @brief Counts a decoded, non-ASCII code point.
+ *
+ * Latin-1 letters are counted through the `latin1` table, everything else
+ * into the sink. A combining tilde right after an n turns that n into an ñ, so
+ * decomposed text is counted like precomposed text.
+ *
+ * @param counts The counts table to increment, with `CSTATS_SLOTS` slots.
+ * @param fold Byte fold table of the CharStats object.
+ * @param latin1 Latin-1 fold table, as built by `utf8_fold_table`.
+ * @param prev The byte right before the code point (0 if unknown).
+ * @param cp The code point.
+ */
+void utf8_count_cp(int *counts, const unsigned char *fold, const unsigned char *latin1,
+                   unsigned char prev, unsigned int cp)
+{
+    if (cp == UTF8_COMBINING_TILDE && (prev == 'n' || prev == 'N')) {
+        unsigned int composed = prev == 'n' ? 0xF1 : 0xD1; // ñ or Ñ
+        counts[fold[prev]]--;
+        counts[utf8_slot(latin1, composed)]++;
+    }
+    counts[utf8_slot(latin1, cp)]++;
+}
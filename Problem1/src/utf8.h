@@ -0,0 +1,32 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <stddef.h>
+#include "charstats.h"
+
+// First code point covered by the Latin-1 fold table, and its size
+#define UTF8_LATIN1_FIRST 0xC0
+#define UTF8_LATIN1_N 64
+// Combining tilde, which follows a plain n in decomposed (NFD) text
+#define UTF8_COMBINING_TILDE 0x303
+
+int utf8_seq_len(unsigned char lead);
+unsigned int utf8_decode(const unsigned char *seq, int n);
+
+void utf8_fold_table(unsigned char *latin1, int case_sensitive, int mode);
+size_t utf8_count(int *counts, const unsigned char *fold, int case_sensitive,
+                  const unsigned char *latin1, unsigned char prev,
+                  const unsigned char *buf, size_t len);
+void utf8_count_cp(int *counts, const unsigned char *fold, const unsigned char *latin1,
+                   unsigned char prev, unsigned int cp);
+
+/** @brief Returns the counts slot of a decoded, non-ASCII code point. */
+static inline int utf8_slot(const unsigned char *latin1, unsigned int cp)
+{
+    if (cp >= UTF8_LATIN1_FIRST && cp < UTF8_LATIN1_FIRST + UTF8_LATIN1_N) {
+        return latin1[cp - UTF8_LATIN1_FIRST];
+    }
+    return CSTATS_SINK;
+}
+
+#endif
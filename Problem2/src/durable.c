@@ -0,0 +1,392 @@
+#include "durable.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+static int commit(DurableFile *df, int sync, const struct iovec *iov, int n);
+static int write_all(int fd, struct iovec *iov, int n);
+static void *committer(void *df_ptr);
+static void latency_add(DurableLatency *lat, double secs);
+static double latency_quantile(const DurableLatency *lat, double q);
+static double now(void);
+
+
+/** @brief Parses a durability policy.
+ *
+ * Accepted specs: `none`, `each`, `lines:<n>` (sync every n lines) and
+ * `ms:<n>` (group commit: sync at most n milliseconds after an append).
+ *
+ * @param spec The policy spec.
+ * @param policy Set to the parsed policy.
+ * @return 0 if the spec is valid, 1 otherwise.
+ */
+int durable_parse(const char *spec, DurablePolicy *policy)
+{
+    char *end;
+    policy->n = 0;
+    if (strcmp(spec, "none") == 0)  policy->mode = DURABLE_NONE;
+    else if (strcmp(spec, "each") == 0)  policy->mode = DURABLE_EACH;
+    else if (strncmp(spec, "lines:", 6) == 0) {
+        policy->mode = DURABLE_LINES;
+        policy->n = strtol(spec + 6, &end, 10);
+        if (policy->n < 1 || *end != '\0')  return 1;
+    }
+    else if (strncmp(spec, "ms:", 3) == 0) {
+        policy->mode = DURABLE_INTERVAL;
+        policy->n = strtol(spec + 3, &end, 10);
+        if (policy->n < 1 || *end != '\0')  return 1;
+    }
+    else  return 1;
+    return 0;
+}
+
+/** @brief Writes the spec of a policy (as accepted by `durable_parse`) into a buffer.
+ * @return `buf`
+ */
+const char *durable_name(const DurablePolicy *policy, char *buf, size_t size)
+{
+    switch (policy->mode) {
+    case DURABLE_LINES:     snprintf(buf, size, "lines:%ld", policy->n);  break;
+    case DURABLE_INTERVAL:  snprintf(buf, size, "ms:%ld", policy->n);  break;
+    case DURABLE_EACH:      snprintf(buf, size, "each");  break;
+    default:                snprintf(buf, size, "none");  break;
+    }
+    return buf;
+}
+
+
+/** @brief Opens a file for appending under a durability policy.
+ *
+ * Appends are gathered in a buffer of `DURABLE_BUFFER_SIZE` bytes (larger
+ * ones bypass it) and committed, i.e. written and synced with `fdatasync`,
+ * as the policy says. With `DURABLE_INTERVAL`, a committer thread syncs what
+ * was appended at most `n` ms before, even if no more appends come, so all
+ * the appends of an interval share one sync. Commits write and sync without
+ * holding the lock, so other threads keep appending into a second buffer
+ * meanwhile, and the ones waiting for a sync of their own are all covered by
+ * the next one (group commit).
+ *
+ * @param path Path of the file, which must exist.
+ * @param policy Durability policy.
+ * @return The new durable file, or NULL if the file couldn't be opened.
+ */
+DurableFile *durable_open(const char *path, const DurablePolicy *policy)
+{
+    int fd = open(path, O_WRONLY | O_APPEND);
+    if (fd == -1)  return NULL;
+
+    DurableFile *df = calloc(1, sizeof(DurableFile));
+    df->fd = fd;
+    df->policy = *policy;
+    df->buf = malloc(DURABLE_BUFFER_SIZE);
+    df->spare = malloc(DURABLE_BUFFER_SIZE);
+    pthread_mutex_init(&df->lock, NULL);
+    pthread_cond_init(&df->done, NULL);
+    pthread_cond_init(&df->wake, NULL);
+    if (policy->mode == DURABLE_INTERVAL) {
+        df->threaded = pthread_create(&df->thread, NULL, committer, df) == 0;
+    }
+    return df;
+}
+
+/** @brief Appends data to a durable file.
+ * @param df Durable file
+ * @param buf Data to append
+ * @param len Bytes to append
+ * @param nlines Number of lines in the data, for `DURABLE_LINES`
+ * @return 0 on success, 1 if a write or sync failed (now or before)
+ */
+int durable_write(DurableFile *df, const void *buf, size_t len, unsigned long long nlines)
+{
+    struct iovec iov = { .iov_base = (void *) buf, .iov_len = len };
+    return durable_writev(df, &iov, 1, nlines);
+}
+
+/** @brief Appends several ranges of data to a durable file, in order.
+ *
+ * The ranges are copied into the buffer if they fit, otherwise the buffer
+ * and the ranges are written with one `writev` call. A commit follows if the
+ * policy asks for one, and with `DURABLE_EACH` or `DURABLE_LINES` the call
+ * returns once the data is synced, by this thread or by a commit running
+ * meanwhile.
+ *
+ * @param df Durable file
+ * @param iov Ranges to append
+ * @param n Number of ranges
+ * @param nlines Number of lines in the data, for `DURABLE_LINES`
+ * @return 0 on success, 1 if a write or sync failed (now or before)
+ */
+int durable_writev(DurableFile *df, const struct iovec *iov, int n, unsigned long long nlines)
+{
+    double t0 = now();
+    size_t len = 0;
+    for (int i = 0; i < n; i++)  len += iov[i].iov_len;
+
+    pthread_mutex_lock(&df->lock);
+    // Ranges that don't fit are written by a commit, which can't start before
+    // the running one ends, and must take the buffer they go after
+    while (df->len + len > DURABLE_BUFFER_SIZE && df->committing)  pthread_cond_wait(&df->done, &df->lock);
+    if (!df->dirty) { // The committer thread may be waiting for a first append
+        df->pending_since = t0;
+        if (df->threaded)  pthread_cond_signal(&df->wake);
+    }
+    df->dirty = 1;
+    unsigned long long seq = ++df->seq;
+    df->pending += nlines;
+    df->stats.appends++;
+    df->stats.lines += nlines;
+    df->stats.bytes += len;
+    if (df->len + len <= DURABLE_BUFFER_SIZE) {
+        for (int i = 0; i < n; i++) {
+            memcpy(df->buf + df->len, iov[i].iov_base, iov[i].iov_len);
+            df->len += iov[i].iov_len;
+        }
+    }
+    else {
+        commit(df, 0, iov, n);
+    }
+
+    int mode = df->policy.mode;
+    if (mode == DURABLE_EACH || (mode == DURABLE_LINES && df->pending >= (unsigned long long) df->policy.n)) {
+        // Wait for a sync that started after this append, or run it
+        while (df->synced < seq && !df->status) {
+            if (df->committing)  pthread_cond_wait(&df->done, &df->lock);
+            else  commit(df, 1, NULL, 0);
+        }
+    }
+    else if (mode == DURABLE_INTERVAL && !df->threaded && t0 - df->pending_since >= df->policy.n / 1e3) {
+        commit(df, 1, NULL, 0);
+    }
+    latency_add(&df->stats.append, now() - t0);
+    int status = df->status;
+    pthread_mutex_unlock(&df->lock);
+    return status;
+}
+
+/** @brief Writes the buffer of a durable file and syncs it, whatever the policy.
+ * @return 0 on success, 1 if a write or sync failed (now or before)
+ */
+int durable_commit(DurableFile *df)
+{
+    pthread_mutex_lock(&df->lock);
+    commit(df, 1, NULL, 0);
+    int status = df->status;
+    pthread_mutex_unlock(&df->lock);
+    return status;
+}
+
+/** @brief Commits what is left, closes a durable file and frees it.
+ *
+ * With `DURABLE_NONE` the buffer is only written, not synced.
+ *
+ * @param df Durable file
+ * @param stats If not NULL, set to the statistics of the file.
+ * @return 0 on success, 1 if a write, sync or close failed at any point
+ */
+int durable_close(DurableFile *df, DurableStats *stats)
+{
+    if (df->threaded) {
+        pthread_mutex_lock(&df->lock);
+        df->closing = 1;
+        pthread_cond_signal(&df->wake);
+        pthread_mutex_unlock(&df->lock);
+        pthread_join(df->thread, NULL);
+    }
+    pthread_mutex_lock(&df->lock);
+    commit(df, df->policy.mode != DURABLE_NONE, NULL, 0);
+    pthread_mutex_unlock(&df->lock);
+    if (close(df->fd) == -1)  df->status = 1;
+
+    int status = df->status;
+    if (stats != NULL)  *stats = df->stats;
+    pthread_mutex_destroy(&df->lock);
+    pthread_cond_destroy(&df->done);
+    pthread_cond_destroy(&df->wake);
+    free(df->buf);
+    free(df->spare);
+    free(df);
+    return status;
+}
+
+
+/** @brief Writes the buffer (and some more ranges after it), and syncs the file if asked.
+ *
+ * Must be called with the lock held. It waits for a running commit to end,
+ * takes the buffer (appends go on into the spare one) and releases the lock
+ * while it writes and syncs, so it may return with more data appended. The
+ * sync is skipped if every append before the call is already synced.
+ *
+ * @param df Durable file
+ * @param sync Whether to sync after writing
+ * @param iov Ranges to write after the buffer, or NULL
+ * @param n Number of ranges
+ * @return 0 on success, 1 if the write or sync failed (now or before)
+ */
+static int commit(DurableFile *df, int sync, const struct iovec *iov, int n)
+{
+    while (df->committing)  pthread_cond_wait(&df->done, &df->lock);
+    unsigned long long seq = df->seq;
+    sync = sync && df->synced < seq;
+    if (df->len == 0 && n == 0 && !sync)  return df->status;
+
+    // Take the buffer, and what the sync will cover
+    char *buf = df->buf;
+    struct iovec *all = malloc((n + 1) * sizeof(struct iovec));
+    all[0].iov_base = buf;
+    all[0].iov_len = df->len;
+    if (n > 0)  memcpy(all + 1, iov, n * sizeof(struct iovec));
+    df->buf = df->spare;
+    df->spare = NULL;
+    df->len = 0;
+    if (sync) {
+        df->pending = 0;
+        df->dirty = 0;
+    }
+    df->committing = 1;
+    pthread_mutex_unlock(&df->lock);
+
+    int failed = write_all(df->fd, all, n + 1);
+    double t0 = now(), elapsed = 0;
+    if (sync) {
+        if (fdatasync(df->fd) == -1 && errno != EINVAL)  failed = 1; // EINVAL: can't be synced (pipe)
+        elapsed = now() - t0;
+    }
+
+    pthread_mutex_lock(&df->lock);
+    df->spare = buf;
+    free(all);
+    if (failed)  df->status = 1;
+    if (sync) {
+        latency_add(&df->stats.sync, elapsed);
+        if (!failed)  df->synced = seq;
+    }
+    df->committing = 0;
+    pthread_cond_broadcast(&df->done);
+    return df->status;
+}
+
+/** @brief Writes all of some ranges, retrying on partial writes and interruptions.
+ *
+ * The ranges are updated as they are written.
+ *
+ * @return 0 on success, 1 on a write error
+ */
+static int write_all(int fd, struct iovec *iov, int n)
+{
+    while (n > 0) {
+        ssize_t nwritten = writev(fd, iov, n < IOV_MAX ? n : IOV_MAX);
+        if (nwritten == -1) {
+            if (errno == EINTR)  continue;
+            return 1;
+        }
+        while (n > 0 && (size_t) nwritten >= iov->iov_len) {
+            nwritten -= iov->iov_len;
+            iov++;  n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char *) iov->iov_base + nwritten;
+            iov->iov_len -= nwritten;
+        }
+    }
+    return 0;
+}
+
+/** @brief Committer thread of `DURABLE_INTERVAL`.
+ *
+ * Sleeps until the oldest uncommitted append is `n` ms old, then commits
+ * everything appended so far in one sync.
+ *
+ * @param df_ptr Pointer to the `DurableFile`
+ * @return NULL
+ */
+static void *committer(void *df_ptr)
+{
+    DurableFile *df = df_ptr;
+    pthread_mutex_lock(&df->lock);
+    while (!df->closing) {
+        if (!df->dirty) {
+            pthread_cond_wait(&df->wake, &df->lock);
+            continue;
+        }
+        double deadline = df->pending_since + df->policy.n / 1e3;
+        if (now() >= deadline) {
+            commit(df, 1, NULL, 0);
+            continue;
+        }
+        // The condition variable waits on the realtime clock
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        double wait = deadline - now();
+        ts.tv_sec += (time_t) wait;
+        ts.tv_nsec += (long) ((wait - (time_t) wait) * 1e9);
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&df->wake, &df->lock, &ts);
+    }
+    pthread_mutex_unlock(&df->lock);
+    return NULL;
+}
+
+
+/** @brief Prints the statistics of a durable file, on two lines.
+ *
+ * Quantiles are upper bounds, from the power of two histograms.
+ */
+void durable_report(const DurableStats *stats, const DurablePolicy *policy, FILE *fp)
+{
+    char name[32];
+    const DurableLatency *a = &stats->append, *s = &stats->sync;
+    fprintf(fp, "Durability '%s': %llu appends (%llu lines, %llu bytes), %llu syncs\n",
+            durable_name(policy, name, sizeof(name)), stats->appends, stats->lines, stats->bytes, s->count);
+    fprintf(fp, "Append latency (us): avg %.1f, p50 < %.1f, p99 < %.1f, max %.1f",
+            a->count ? 1e6 * a->total / a->count : 0.0, 1e6 * latency_quantile(a, 0.5),
+            1e6 * latency_quantile(a, 0.99), 1e6 * a->max);
+    if (s->count > 0) {
+        fprintf(fp, "; sync latency (us): avg %.1f, max %.1f", 1e6 * s->total / s->count, 1e6 * s->max);
+    }
+    fprintf(fp, "\n");
+}
+
+/** @brief Adds a sample to a latency distribution. */
+static void latency_add(DurableLatency *lat, double secs)
+{
+    unsigned long long ns = secs > 0 ? (unsigned long long) (secs * 1e9) : 0;
+    int k = 0;
+    while (ns > 0 && k < DURABLE_HIST_N-1) {
+        ns >>= 1;
+        k++;
+    }
+    lat->hist[k]++;
+    lat->count++;
+    lat->total += secs;
+    if (secs > lat->max)  lat->max = secs;
+}
+
+/** @brief Returns an upper bound of a quantile of a latency distribution, in seconds. */
+static double latency_quantile(const DurableLatency *lat, double q)
+{
+    unsigned long long target = (unsigned long long) (q * lat->count), seen = 0;
+    for (int k = 0; k < DURABLE_HIST_N; k++) {
+        seen += lat->hist[k];
+        if (seen > target)  return (double) (1ULL << k) / 1e9;
+    }
+    return lat->max;
+}
+
+/** @brief Returns a monotonic timestamp in seconds. */
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
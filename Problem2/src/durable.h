@@ -0,0 +1,87 @@
+#ifndef DURABLE_H
+#define DURABLE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+// Durability modes: when appended data is written and synced to disk
+#define DURABLE_NONE 0      // Written when the buffer fills up, never synced
+#define DURABLE_LINES 1     // Written and synced every n lines
+#define DURABLE_INTERVAL 2  // Written and synced at most n ms after it was appended (group commit)
+#define DURABLE_EACH 3      // Written and synced on every append
+
+// Size of the buffer appends are gathered in between commits
+#define DURABLE_BUFFER_SIZE (64*1024)
+// Number of buckets of the latency histograms (powers of two of nanoseconds)
+#define DURABLE_HIST_N 40
+
+// A durability policy, as parsed by durable_parse
+typedef struct durable_policy {
+    int mode;
+    long n;  // Lines for DURABLE_LINES, milliseconds for DURABLE_INTERVAL
+} DurablePolicy;
+
+// Latency distribution: bucket k counts samples in [2^(k-1), 2^k) ns
+typedef struct durable_latency {
+    unsigned long long count;
+    double total;  // Seconds
+    double max;    // Seconds
+    unsigned long long hist[DURABLE_HIST_N];
+} DurableLatency;
+
+// What happened to a durable file
+typedef struct durable_stats {
+    unsigned long long appends;  // Calls to durable_write/durable_writev
+    unsigned long long lines;
+    unsigned long long bytes;
+    DurableLatency append;       // Time spent in each append (including commits it did)
+    DurableLatency sync;         // Time spent in each fdatasync
+} DurableStats;
+
+// A file opened for appending under a durability policy
+typedef struct durable_file {
+    int fd;
+    DurablePolicy policy;
+    // Data appended but not written yet, and the buffer it is swapped with
+    // when a commit takes it (NULL while that commit is writing it)
+    char *buf;
+    size_t len;
+    char *spare;
+    // Lines appended since the last sync, when the oldest append was, and
+    // whether there was any append since
+    unsigned long long pending;
+    double pending_since;
+    int dirty;
+    // Appends so far, and how many of them are known to be synced
+    unsigned long long seq;
+    unsigned long long synced;
+    DurableStats stats;
+    int status;  // 1 once a write or sync failed
+
+    // Everything above is shared under `lock`. A commit only holds it to take
+    // the buffer and to publish its result, and `committing` keeps a second
+    // one from starting meanwhile; `done` is signalled when it ends.
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    int committing;
+    // Committer thread of DURABLE_INTERVAL
+    pthread_cond_t wake;
+    pthread_t thread;
+    int threaded;
+    int closing;
+} DurableFile;
+
+int durable_parse(const char *spec, DurablePolicy *policy);
+const char *durable_name(const DurablePolicy *policy, char *buf, size_t size);
+
+DurableFile *durable_open(const char *path, const DurablePolicy *policy);
+int durable_write(DurableFile *df, const void *buf, size_t len, unsigned long long nlines);
+int durable_writev(DurableFile *df, const struct iovec *iov, int n, unsigned long long nlines);
+int durable_commit(DurableFile *df);
+int durable_close(DurableFile *df, DurableStats *stats);
+
+void durable_report(const DurableStats *stats, const DurablePolicy *policy, FILE *fp);
+
+#endif
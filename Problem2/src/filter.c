@@ -0,0 +1,181 @@
+#include "filter.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "palindrome.h"
+
+static void out_add(FilterOut *out, const char *line, size_t len);
+
+
+/** @brief Filters the palindromes of an input stream into a file, without any messages.
+ *
+ * The input is read in blocks of `FILTER_BLOCK_SIZE` bytes (grown for longer
+ * lines) and split into lines by `filter_block`. Accepted lines aren't
+ * copied: they are kept as ranges of the input buffer and written with
+ * `writev` before the buffer is reused. The output file gets exactly the same
+ * bytes as in the interactive mode.
+ *
+ * @param in_fd File descriptor to read lines from.
+ * @param out_df File to append the palindromes to.
+ * @param num_mode Whether only numbers are accepted (the `-num` option).
+ * @param seen Lines already in the output, to skip (see `filter_dedup`), or NULL.
+ * @param summary Set to the counts of the run.
+ * @return 0 on success, 1 on a read or write error (reported on stderr).
+ */
+int filter_run(int in_fd, DurableFile *out_df, int num_mode, LineSet *seen, FilterSummary *summary)
+{
+    memset(summary, 0, sizeof(*summary));
+    size_t size = FILTER_BLOCK_SIZE;
+    char *buf = malloc(size);
+    FilterOut out = { .iov = NULL, .n = 0, .size = 0, .nlines = 0 };
+
+    size_t have = 0; // Bytes in the buffer, starting with an incomplete line
+    int status = 0, eof = 0;
+    while (!eof) {
+        if (have == size)  buf = realloc(buf, size *= 2); // Line longer than the buffer
+        ssize_t nread = read(in_fd, buf + have, size - have);
+        if (nread == -1) {
+            if (errno == EINTR)  continue;
+            perror("Error reading input");
+            status = 1;
+            break;
+        }
+        eof = nread == 0;
+        have += nread;
+
+        size_t done = filter_block(buf, have, eof, num_mode, summary, &out);
+        if (seen != NULL)  filter_dedup(&out, seen, summary);
+        // The buffer is about to be reused
+        if (filter_flush(&out, out_df)) {
+            status = 1;
+            break;
+        }
+        memmove(buf, buf + done, have - done);
+        have -= done;
+    }
+
+    free(out.iov);
+    free(buf);
+    return status;
+}
+
+
+/** @brief Tests the lines of a buffer, adding the accepted ones to a batch.
+ *
+ * Lines are tested with `pal_classify`, like the interactive mode does, and
+ * empty lines are skipped. Accepted lines are added to `out` as ranges of
+ * `buf`, merged when consecutive, so `buf` must outlive them.
+ *
+ * @param buf Buffer with the lines.
+ * @param len Bytes in the buffer.
+ * @param eof Whether the input ends with the buffer. If so, a last line
+ *            without a newline is tested too; otherwise it is left.
+ * @param num_mode Whether only numbers are accepted.
+ * @param summary Counts to add the lines to.
+ * @param out Batch to add the accepted lines to.
+ * @return Number of bytes consumed (the start of the incomplete last line).
+ */
+size_t filter_block(const char *buf, size_t len, int eof, int num_mode,
+                    FilterSummary *summary, FilterOut *out)
+{
+    size_t start = 0;
+    while (start < len) {
+        const char *nl = memchr(buf + start, '\n', len - start);
+        if (nl == NULL && !eof)  break;
+        size_t n = nl != NULL ? (size_t) (nl - buf) + 1 - start : len - start;
+        const char *line = buf + start;
+        start += n;
+        if (line[0] == '\n')  continue;
+
+        summary->lines++;
+        int flags = pal_classify(line, n, num_mode);
+        if (num_mode && !(flags & PAL_NUMBER))  summary->not_numbers++;
+        else if (!(flags & PAL_PALINDROME))  summary->rejected++;
+        else {
+            summary->palindromes++;
+            out_add(out, line, n);
+        }
+    }
+    return start;
+}
+
+/** @brief Removes the lines of a batch that are already in a set, and adds the others to it.
+ *
+ * Merged ranges are split back into lines. Lines are checked in order, so the
+ * first of several copies is the one kept. The skipped lines are moved from
+ * the palindromes to the duplicates of `summary`.
+ *
+ * @param out Batch to filter
+ * @param seen Set of the lines written so far
+ * @param summary Counts of the lines of the batch
+ */
+void filter_dedup(FilterOut *out, LineSet *seen, FilterSummary *summary)
+{
+    int n = out->n;
+    struct iovec *ranges = malloc(n * sizeof(struct iovec));
+    memcpy(ranges, out->iov, n * sizeof(struct iovec));
+    out->n = 0;
+    out->nlines = 0;
+
+    for (int r = 0; r < n; r++) {
+        const char *data = ranges[r].iov_base;
+        size_t len = ranges[r].iov_len, start = 0;
+        while (start < len) {
+            const char *nl = memchr(data + start, '\n', len - start);
+            size_t k = nl != NULL ? (size_t) (nl - data) + 1 - start : len - start;
+            if (lineset_insert(seen, data + start, k))  out_add(out, data + start, k);
+            else {
+                summary->palindromes--;
+                summary->duplicates++;
+            }
+            start += k;
+        }
+    }
+    free(ranges);
+}
+
+/** @brief Adds a line to the batch, merging it with the last range if they touch. */
+static void out_add(FilterOut *out, const char *line, size_t len)
+{
+    out->nlines++;
+    if (out->n > 0) {
+        struct iovec *last = &out->iov[out->n-1];
+        if ((char *) last->iov_base + last->iov_len == line) {
+            last->iov_len += len;
+            return;
+        }
+    }
+    if (out->n == out->size) {
+        out->size = out->size ? out->size * 2 : 64;
+        out->iov = realloc(out->iov, out->size * sizeof(struct iovec));
+    }
+    out->iov[out->n].iov_base = (void *) line;
+    out->iov[out->n].iov_len = len;
+    out->n++;
+}
+
+/** @brief Appends all the ranges of a batch to the output, and empties it.
+ * @param out Batch to write
+ * @param df File to append to
+ * @return 0 on success, 1 on a write error (reported on stderr).
+ */
+int filter_flush(FilterOut *out, DurableFile *df)
+{
+    int status = out->n > 0 && durable_writev(df, out->iov, out->n, out->nlines);
+    out->n = 0;
+    out->nlines = 0;
+    if (status)  fprintf(stderr, "Error writing\n");
+    return status;
+}
+
+/** @brief Adds the counts of a summary to another one. */
+void filter_summary_add(FilterSummary *summary, const FilterSummary *other)
+{
+    summary->lines += other->lines;
+    summary->palindromes += other->palindromes;
+    summary->rejected += other->rejected;
+    summary->not_numbers += other->not_numbers;
+    summary->duplicates += other->duplicates;
+}
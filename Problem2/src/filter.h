@@ -0,0 +1,37 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+#include "lineset.h"
+#include "durable.h"
+
+// Size of the blocks read from the input at once
+#define FILTER_BLOCK_SIZE (1024*1024)
+
+// What happened to the lines of a filter run
+typedef struct filter_summary {
+    unsigned long long lines;        // Non-empty lines read
+    unsigned long long palindromes;  // Lines written to the output
+    unsigned long long rejected;     // Lines that were not palindromes
+    unsigned long long not_numbers;  // Lines rejected by the digit test
+    unsigned long long duplicates;   // Palindromes skipped as already written
+} FilterSummary;
+
+// Accepted lines waiting to be written, as ranges of an input buffer
+typedef struct filter_out {
+    struct iovec *iov;
+    int n;
+    int size;
+    unsigned long long nlines;
+} FilterOut;
+
+int filter_run(int in_fd, DurableFile *out, int num_mode, LineSet *seen, FilterSummary *summary);
+
+size_t filter_block(const char *buf, size_t len, int eof, int num_mode,
+                    FilterSummary *summary, FilterOut *out);
+void filter_dedup(FilterOut *out, LineSet *seen, FilterSummary *summary);
+int filter_flush(FilterOut *out, DurableFile *df);
+void filter_summary_add(FilterSummary *summary, const FilterSummary *other);
+
+#endif
@@ -0,0 +1,147 @@
+#include "lineset.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static uint32_t line_hash(const char *line, size_t len);
+static void grow(LineSet *set);
+
+
+/** @brief Initializes an empty set. */
+void lineset_init(LineSet *set)
+{
+    set->slots = calloc(LINESET_MIN_SLOTS, sizeof(LineSlot));
+    set->mask = LINESET_MIN_SLOTS - 1;
+    set->count = 0;
+    set->arena = NULL;
+    set->arena_len = 0;
+    set->arena_size = 0;
+}
+
+/** @brief Frees the table and the arena of a set. */
+void lineset_free(LineSet *set)
+{
+    free(set->slots);
+    free(set->arena);
+}
+
+/** @brief Adds a line to a set, unless it is already there.
+ *
+ * A trailing newline is not part of the line, so the last line of a file
+ * matches the same line with a newline.
+ *
+ * @param set Set to add to.
+ * @param line The line (it needn't be `'\0'`-terminated).
+ * @param len Length of the line.
+ * @return 1 if the line was added, 0 if it was already in the set.
+ */
+int lineset_insert(LineSet *set, const char *line, size_t len)
+{
+    if (len > 0 && line[len-1] == '\n')  len--;
+
+    uint32_t hash = line_hash(line, len);
+    size_t i = hash & set->mask;
+    for (; set->slots[i].hash != 0; i = (i + 1) & set->mask) {
+        if (set->slots[i].hash != hash)  continue;
+        const char *entry = set->arena + set->slots[i].entry;
+        uint64_t entry_len;
+        memcpy(&entry_len, entry, sizeof(entry_len));
+        if (entry_len == len && memcmp(entry + sizeof(entry_len), line, len) == 0)  return 0;
+    }
+
+    // New line: append it to the arena
+    uint64_t len64 = len;
+    size_t size = (sizeof(len64) + len + 7) & ~(size_t) 7;
+    if (set->arena_len + size > set->arena_size) {
+        set->arena_size = 2 * set->arena_size + size;
+        set->arena = realloc(set->arena, set->arena_size);
+    }
+    set->slots[i].hash = hash;
+    set->slots[i].entry = set->arena_len;
+    memcpy(set->arena + set->arena_len, &len64, sizeof(len64));
+    memcpy(set->arena + set->arena_len + sizeof(len64), line, len);
+    set->arena_len += size;
+
+    if (++set->count > (set->mask + 1) / 4 * 3)  grow(set);
+    return 1;
+}
+
+/** @brief Adds every line of a file to a set.
+ *
+ * The file is mapped into memory and split in place, so loading costs one
+ * sequential pass over it.
+ *
+ * @param set Set to add to.
+ * @param path Path of the file.
+ * @return 0 if the file was loaded, 1 if it couldn't be opened or mapped.
+ */
+int lineset_load(LineSet *set, const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)  return 1;
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return 1;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    const char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)  return 1;
+    madvise((void *) data, st.st_size, MADV_SEQUENTIAL);
+
+    size_t len = st.st_size, start = 0;
+    while (start < len) {
+        const char *nl = memchr(data + start, '\n', len - start);
+        size_t n = nl != NULL ? (size_t) (nl - data) + 1 - start : len - start;
+        if (data[start] != '\n')  lineset_insert(set, data + start, n);
+        start += n;
+    }
+
+    munmap((void *) data, st.st_size);
+    return 0;
+}
+
+
+/** @brief Doubles the table of a set, rehashing from the stored hashes. */
+static void grow(LineSet *set)
+{
+    size_t nslots = 2 * (set->mask + 1);
+    LineSlot *slots = calloc(nslots, sizeof(LineSlot));
+    for (size_t i = 0; i <= set->mask; i++) {
+        if (set->slots[i].hash == 0)  continue;
+        size_t j = set->slots[i].hash & (nslots - 1);
+        while (slots[j].hash != 0)  j = (j + 1) & (nslots - 1);
+        slots[j] = set->slots[i];
+    }
+    free(set->slots);
+    set->slots = slots;
+    set->mask = nslots - 1;
+}
+
+/** @brief Hashes a line, 8 bytes at a time (multiply-xorshift). Never returns 0. */
+static uint32_t line_hash(const char *line, size_t len)
+{
+    const uint64_t k = 0x9E3779B97F4A7C15ULL;
+    uint64_t h = len * k;
+    size_t i;
+    for (i = 0; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, line + i, 8);
+        h = (h ^ w) * k;
+        h ^= h >> 32;
+    }
+    uint64_t w = 0;
+    memcpy(&w, line + i, len - i);
+    h = (h ^ w) * k;
+    h ^= h >> 29;
+    return (uint32_t) (h >> 32) != 0 ? (uint32_t) (h >> 32) : 1;
+}
@@ -2,9 +2,19 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
-
-
-#define USAGE "Usage: palindrome <fileName> [-num]\n"
+#include <fcntl.h>
+#include "palindrome.h"
+#include "filter.h"
+#include "parallel.h"
+#include "lineset.h"
+#include "search.h"
+#include "durable.h"
+
+
+#define USAGE "Usage: palindrome <fileName> [-num] [-quiet] [-j<threads>] [-in=<inputFile>] [-dedup]\n" \
+              "                  [-sync=none|each|lines:<n>|ms:<n>]\n" \
+              "       palindrome <fileName> -longest|-min=<length> [-whole] [-in=<inputFile>]\n" \
+              "                  [-sync=none|each|lines:<n>|ms:<n>]\n"
 #define BUFFER_SIZE 1024
 
 
@@ -12,78 +22,86 @@ typedef struct args {
     int status;
     char *filename;
     int numMode;
+    int quietMode;
+    int threads;
+    char *input;
+    int dedupMode;
+    int searchMode;
+    SearchOptions search;
+    int syncMode;
+    DurablePolicy sync;
 } Arguments;
 
 
 
 Arguments process_args(int argc, char **argv);
-int num_check(char *str);
-int str_palindrome(char *str);
 
 Arguments process_args(int argc, char **argv)
 {
     Arguments args = {
         .status = 0,
         .filename = NULL,
-        .numMode = 0
+        .numMode = 0,
+        .quietMode = 0,
+        .threads = 0,
+        .input = NULL,
+        .dedupMode = 0,
+        .searchMode = 0,
+        .search = { .min_len = 0, .whole = 0 },
+        .syncMode = 0,
+        .sync = { .mode = DURABLE_NONE, .n = 0 }
     };
 
-    if (argc < 2 || argc >3) { // Arg count check
-        args.status = 1;
-        args.filename = "Wrong number of arguments (2-3 expected)\n";
-        return args;
-    }
-
-    int numIndex = 2;
-
-    if (argc == 3) { // One arg must be "-num", the other one a filename.
-        if (argv[1][0] == '-') { // One arg must start with '-' to be "-num"
-            numIndex = 1;
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] != '-') { // Not an option, must be the only filename
+            if (args.filename != NULL) {
+                args.status = 1;
+                args.filename = "Wrong syntax (only one file expected)\n";
+                return args;
+            }
+            args.filename = argv[i];
         }
-        else if (argv[2][0] == '-') {
-            numIndex = 2;
+        else if (strcmp(argv[i], "-num") == 0)  args.numMode = 1;
+        else if (strcmp(argv[i], "-quiet") == 0)  args.quietMode = 1;
+        else if (strcmp(argv[i], "-dedup") == 0)  args.dedupMode = 1;
+        else if (strcmp(argv[i], "-longest") == 0)  args.searchMode = 1;
+        else if (strncmp(argv[i], "-min=", 5) == 0 && atoi(argv[i] + 5) > 0) {
+            args.search.min_len = atoi(argv[i] + 5);
+            args.searchMode = 1;
         }
-        else {
-            args.status = 1;
-            args.filename = "Wrong syntax\n";
-            return args;
+        else if (strcmp(argv[i], "-whole") == 0)  args.search.whole = 1;
+        else if (strncmp(argv[i], "-sync=", 6) == 0 && durable_parse(argv[i] + 6, &args.sync) == 0) {
+            args.syncMode = 1;
         }
-
-        if (strcmp(argv[numIndex], "-num") != 0) { // '-' argument must be "-num"
+        else if (strncmp(argv[i], "-j", 2) == 0 && atoi(argv[i] + 2) > 0) {
+            args.threads = atoi(argv[i] + 2);
+            args.quietMode = 1;
+        }
+        else if (strncmp(argv[i], "-in=", 4) == 0 && argv[i][4] != '\0') {
+            args.input = argv[i] + 4;
+            args.quietMode = 1;
+        }
+        else {
             args.status = 1;
-            args.filename = "Wrong option (only \"-num\" expected)\n";
+            args.filename = "Wrong option (\"-num\", \"-quiet\", \"-j<threads>\" or \"-in=<inputFile>\", \"-dedup\", \"-longest\", \"-min=<length>\", \"-whole\" or \"-sync=<policy>\" expected)\n";
             return args;
         }
-        args.numMode = 1;
     }
-    
-    args.filename = argv[3-numIndex];
-
-    return args;
-}
 
-
-int num_check(char *str)
-{
-    for (int i=0; str[i]!='\0'; i++) {
-        if (str[i]=='\n') continue;
-        if (str[i]<'0' || str[i]>'9')  return 0;
+    if (args.filename == NULL) { // No filename
+        args.status = 1;
+        args.filename = "Wrong number of arguments (a file is expected)\n";
     }
-    return 1;
-}
-
-
-int str_palindrome(char *str) 
-{
-    int i, j;
-    for (j=strlen(str)-1; j>=0; j--) {
-        if (str[j] != '\n' && str[j] != ' ')  break;
+    else if (args.search.whole && !args.searchMode) {
+        args.status = 1;
+        args.filename = "Wrong syntax (\"-whole\" needs \"-longest\" or \"-min=<length>\")\n";
     }
-    for (i=0; i<j; ) {
-        if (str[i] != str[j])  return 0;
-        i++; j--;
+    else if (args.searchMode && (args.numMode || args.dedupMode || args.threads)) {
+        args.status = 1;
+        args.filename = "Wrong syntax (searches can't be combined with \"-num\", \"-dedup\" or \"-j\")\n";
     }
-    return 1;
+
+    return args;
 }
 
 
@@ -100,21 +118,90 @@ int main(int argc, char **argv)
         fprintf(stderr, "Can't access file '%s', check existence and permissions.\n", args.filename);
         exit(EXIT_FAILURE);
     }
-    FILE *fp = fopen(args.filename, "a");
+
+    if (args.searchMode) { // Palindromic substrings, with their offsets
+        int in_fd = args.input != NULL ? open(args.input, O_RDONLY) : STDIN_FILENO;
+        if (in_fd == -1) {
+            fprintf(stderr, "Can't open input file '%s'\n", args.input);
+            exit(EXIT_FAILURE);
+        }
+        DurableFile *df = durable_open(args.filename, &args.sync);
+        if (df == NULL) {
+            fprintf(stderr, "Can't open file '%s'\n", args.filename);
+            exit(EXIT_FAILURE);
+        }
+        unsigned long long nmatches;
+        int status = search_run(in_fd, df, &args.search, &nmatches);
+        DurableStats stats;
+        if (durable_close(df, &stats))  status = 1;
+        if (in_fd != STDIN_FILENO)  close(in_fd);
+        printf("%llu palindromes added to '%s'\n", nmatches, args.filename);
+        if (args.syncMode)  durable_report(&stats, &args.sync, stdout);
+        exit(status ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+
+    // Lines already in the file, so they aren't added again
+    LineSet seen;
+    if (args.dedupMode) {
+        lineset_init(&seen);
+        if (lineset_load(&seen, args.filename)) {
+            fprintf(stderr, "Can't load file '%s' to skip its lines.\n", args.filename);
+            exit(EXIT_FAILURE);
+        }
+    }
+    LineSet *seenp = args.dedupMode ? &seen : NULL;
+
+    if (args.quietMode) { // Batch filter, only the summary is printed
+        int in_fd = args.input != NULL ? open(args.input, O_RDONLY) : STDIN_FILENO;
+        if (in_fd == -1) {
+            fprintf(stderr, "Can't open input file '%s'\n", args.input);
+            exit(EXIT_FAILURE);
+        }
+        DurableFile *df = durable_open(args.filename, &args.sync);
+        if (df == NULL) {
+            fprintf(stderr, "Can't open file '%s'\n", args.filename);
+            exit(EXIT_FAILURE);
+        }
+        FilterSummary summary;
+        int status;
+        if (args.threads > 0)  status = parallel_run(in_fd, df, args.numMode, seenp, args.threads, &summary);
+        else  status = filter_run(in_fd, df, args.numMode, seenp, &summary);
+        DurableStats stats;
+        if (durable_close(df, &stats))  status = 1;
+        if (in_fd != STDIN_FILENO)  close(in_fd);
+        printf("%llu lines: %llu palindromes added to '%s', %llu not palindromes",
+               summary.lines, summary.palindromes, args.filename, summary.rejected);
+        if (args.numMode)  printf(", %llu not numbers", summary.not_numbers);
+        if (args.dedupMode)  printf(", %llu duplicates", summary.duplicates);
+        printf("\n");
+        if (args.syncMode)  durable_report(&stats, &args.sync, stdout);
+        if (seenp != NULL)  lineset_free(seenp);
+        exit(status ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+
+    DurableFile *df = durable_open(args.filename, &args.sync);
+    if (df == NULL) {
+        fprintf(stderr, "Can't open file '%s'\n", args.filename);
+        exit(EXIT_FAILURE);
+    }
 
     size_t nchars = BUFFER_SIZE;
     char *line = calloc(nchars, sizeof(char));
     while (!feof(stdin)) {
-        if (getline(&line, &nchars, stdin) == -1 || line[0] == '\n')  continue;
+        ssize_t len = getline(&line, &nchars, stdin);
+        if (len == -1 || line[0] == '\n')  continue;
 
-        if (args.numMode && !num_check(line)) {
+        int flags = pal_classify(line, len, args.numMode);
+        if (args.numMode && !(flags & PAL_NUMBER)) {
             printf("That was not a number. Try entering a number, or running without the \"-num\" option.\n");
             continue;
         }
-        if (str_palindrome(line)) {
+        if ((flags & PAL_PALINDROME) && seenp != NULL && !lineset_insert(seenp, line, len)) {
+            printf("^ That was a palindrome, but it's already in file '%s'.\n", args.filename);
+        }
+        else if (flags & PAL_PALINDROME) {
             printf("^ That was a palindrome! Adding to file '%s'... ", args.filename);
-            int nwritten = fwrite(line, sizeof(char), strlen(line), fp);
-            if (nwritten == -1)  printf("Error writing.\n");
+            if (durable_write(df, line, len, 1))  printf("Error writing.\n");
             else  printf("Done. Use Ctrl+D to save and exit.\n");
         }
         else {
@@ -125,9 +212,12 @@ int main(int argc, char **argv)
     printf("Exiting... ");
 
     free(line);
-    fclose(fp);
+    DurableStats stats;
+    int status = durable_close(df, &stats);
+    if (seenp != NULL)  lineset_free(seenp);
 
-    printf("Done.\n");
+    printf("%s.\n", status ? "Error writing" : "Done");
+    if (args.syncMode)  durable_report(&stats, &args.sync, stdout);
 
     exit(EXIT_SUCCESS);
 }
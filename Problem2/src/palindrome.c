@@ -0,0 +1,298 @@
+#include "palindrome.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define PAL_X86 1
+#endif
+
+// A comparison kernel. It checks the outer blocks of the line, from both ends
+// at once, and returns how many bytes it consumed from each end. The middle is
+// left to the scalar loop.
+typedef size_t (*PalKernel)(const unsigned char *str, size_t len, int digits, int *flags);
+
+// Palindrome radii computed by manacher: 32-bit ones (`r32`) when the string
+// is short enough for them, `size_t` ones (`r64`) otherwise
+typedef struct radii {
+    uint32_t *r32;
+    size_t *r64;
+} Radii;
+
+static size_t kernel_none(const unsigned char *str, size_t len, int digits, int *flags);
+#ifdef PAL_X86
+static size_t kernel_sse2(const unsigned char *str, size_t len, int digits, int *flags);
+static size_t kernel_avx2(const unsigned char *str, size_t len, int digits, int *flags);
+#endif
+
+static void pal_resolve(void);
+static void manacher(const unsigned char *str, size_t len, Radii *rad);
+static inline size_t rad_get(const Radii *rad, size_t j);
+
+// Kernel in use, resolved once on the first call
+static PalKernel kernel = kernel_none;
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+
+/** @brief Checks whether a line is a palindrome and whether it is a number, in one sweep.
+ *
+ * Trailing spaces and newlines are trimmed for the palindrome test, as
+ * `str_palindrome` does. The digit test follows `num_check`: newlines are
+ * ignored, anything else that isn't a digit (trailing spaces included) makes
+ * it fail. Both tests run on the same loads, taking blocks from both ends of
+ * the line and comparing the first one with the byte-reversed second one, so
+ * each byte is read once. The sweep stops as soon as the answer is known.
+ *
+ * @param str The line, with no newlines except at the end. It needn't be `'\0'`-terminated.
+ * @param len Length of the line.
+ * @param digits Whether to run the digit test. If 0, `PAL_NUMBER` is never set.
+ * @return `PAL_PALINDROME` and/or `PAL_NUMBER`, or 0.
+ */
+int pal_classify(const char *str, size_t len, int digits)
+{
+    pthread_once(&kernel_once, pal_resolve);
+    const unsigned char *s = (const unsigned char *) str;
+
+    size_t n = pal_trim(str, len);
+    int flags = PAL_PALINDROME;
+    if (digits) {
+        flags |= PAL_NUMBER;
+        for (size_t k = n; k < len; k++) {
+            if (s[k] != '\n')  flags &= ~PAL_NUMBER;
+        }
+    }
+
+    size_t done = kernel(s, n, digits, &flags);
+    for (size_t i = done, j = n - done; i < j && flags; ) {
+        j--;
+        if (s[i] != s[j])  flags &= ~PAL_PALINDROME;
+        if (digits && ((unsigned) (s[i] - '0') > 9 || (unsigned) (s[j] - '0') > 9)) {
+            flags &= ~PAL_NUMBER;
+        }
+        i++;
+    }
+    return flags;
+}
+
+/** @brief Returns the length of a line without its trailing spaces and newlines. */
+size_t pal_trim(const char *str, size_t len)
+{
+    while (len > 0 && (str[len-1] == '\n' || str[len-1] == ' '))  len--;
+    return len;
+}
+
+/** @brief Checks if a string only contains digits (and newlines).
+ * @param str The string to check
+ * @return 1 if it is a number, 0 otherwise
+ */
+int num_check(char *str)
+{
+    return (pal_classify(str, strlen(str), 1) & PAL_NUMBER) != 0;
+}
+
+/** @brief Checks if a string is a palindrome, ignoring trailing spaces and newlines.
+ * @param str The string to check
+ * @return 1 if it is a palindrome, 0 otherwise
+ */
+int str_palindrome(char *str)
+{
+    return (pal_classify(str, strlen(str), 0) & PAL_PALINDROME) != 0;
+}
+
+
+/** @brief Finds the longest palindromic substring of a string, in linear time.
+ *
+ * If the whole string is a palindrome (checked first with `pal_classify`,
+ * which needs no memory), that's the answer. Otherwise the longest one is
+ * taken from the radii computed by Manacher's algorithm. The first of
+ * several equally long palindromes is returned. No whitespace is trimmed:
+ * use `pal_trim` first for lines.
+ *
+ * @param str The string (it needn't be `'\0'`-terminated).
+ * @param len Length of the string.
+ * @param start Set to the offset of the palindrome in `str`.
+ * @return Length of the palindrome (0 only for an empty string).
+ */
+size_t pal_longest(const char *str, size_t len, size_t *start)
+{
+    *start = 0;
+    if (pal_trim(str, len) == len && (pal_classify(str, len, 0) & PAL_PALINDROME))  return len;
+
+    Radii rad;
+    manacher((const unsigned char *) str, len, &rad);
+    size_t best = 0;
+    for (size_t j = 0; j < 2*len + 1; j++) {
+        size_t k = rad_get(&rad, j);
+        if (k > best) {
+            best = k;
+            *start = (j - k) / 2;
+        }
+    }
+    free(rad.r32);
+    free(rad.r64);
+    return best;
+}
+
+/** @brief Finds every maximal palindrome of a string, in linear time.
+ *
+ * A palindrome is maximal if it can't be extended by one character on each
+ * side, so there is exactly one per center (between or on characters). The
+ * ones at least `min_len` long are reported through `match`, in the order of
+ * their centers. Uses Manacher's algorithm, with 8 bytes of memory per byte
+ * of the string (16 past 4 GiB).
+ *
+ * @param str The string (it needn't be `'\0'`-terminated).
+ * @param len Length of the string.
+ * @param min_len Shortest palindrome to report (at least 1).
+ * @param match Function called for every palindrome found.
+ * @param arg Argument passed through to `match`.
+ */
+void pal_maximal(const char *str, size_t len, size_t min_len, PalMatch match, void *arg)
+{
+    if (min_len < 1)  min_len = 1;
+    Radii rad;
+    manacher((const unsigned char *) str, len, &rad);
+    for (size_t j = 0; j < 2*len + 1; j++) {
+        size_t k = rad_get(&rad, j);
+        if (k >= min_len)  match((j - k) / 2, k, arg);
+    }
+    free(rad.r32);
+    free(rad.r64);
+}
+
+/** @brief Computes the palindrome radius at every center of a string (Manacher).
+ *
+ * Works on the string with a separator around every character, without
+ * building it: position `2k+1` is character `k` and even positions are
+ * separators, so palindromes of even and odd lengths are found alike. The
+ * radius at position `j` is the length of the longest palindrome of the
+ * original string centered there, which starts at `(j - radius) / 2`. Each
+ * expansion moves the rightmost palindrome boundary, so the whole thing is
+ * linear.
+ *
+ * A radius is at most `len`, so they are stored in 32 bits unless the
+ * string is longer than `UINT32_MAX`.
+ *
+ * @param str The string.
+ * @param len Length of the string.
+ * @param rad Set to the `2*len + 1` radii. Both arrays must be freed by the caller.
+ */
+static void manacher(const unsigned char *str, size_t len, Radii *rad)
+{
+    size_t m = 2*len + 1;
+    int wide = len > UINT32_MAX;
+    rad->r32 = wide ? NULL : malloc(m * sizeof(uint32_t));
+    rad->r64 = wide ? malloc(m * sizeof(size_t)) : NULL;
+    size_t center = 0, right = 0; // Palindrome reaching furthest right, and its end
+    for (size_t j = 0; j < m; j++) {
+        size_t k = 0;
+        if (j < right) {
+            k = rad_get(rad, 2*center - j);
+            if (k > right - j)  k = right - j;
+        }
+        // Separators always match, characters must be equal
+        while (k < j && j + k + 1 < m
+               && ((j + k + 1) % 2 == 0 || str[(j - k - 2) / 2] == str[(j + k) / 2])) {
+            k++;
+        }
+        if (wide)  rad->r64[j] = k;
+        else  rad->r32[j] = k;
+        if (j + k > right) {
+            center = j;
+            right = j + k;
+        }
+    }
+}
+
+/** @brief Returns the radius at position `j`, whatever its width. */
+static inline size_t rad_get(const Radii *rad, size_t j)
+{
+    return rad->r32 != NULL ? rad->r32[j] : rad->r64[j];
+}
+
+
+/** @brief Picks the widest kernel this CPU supports (through CPUID). */
+static void pal_resolve(void)
+{
+#ifdef PAL_X86
+    __builtin_cpu_init();
+    kernel = __builtin_cpu_supports("avx2") ? kernel_avx2 : kernel_sse2;
+#endif
+}
+
+/** @brief Portable kernel: leaves the whole line to the scalar loop. */
+static size_t kernel_none(const unsigned char *str, size_t len, int digits, int *flags)
+{
+    (void) str;  (void) len;  (void) digits;  (void) flags;
+    return 0;
+}
+
+#ifdef PAL_X86
+/** @brief Reverses the 16 bytes of a vector with SSE2 shuffles only. */
+static inline __m128i reverse_sse2(__m128i v)
+{
+    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)); // Bytes in each word
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));          // Words in each half
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+    return _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));         // Halves
+}
+
+/** @brief Whether all 16 bytes of a vector are ASCII digits. */
+static inline int digits_sse2(__m128i v)
+{
+    __m128i d = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d)) == 0xFFFF;
+}
+
+/** @brief SSE2 kernel: 16 bytes from each end per step.
+ * @return Bytes consumed from each end (a multiple of 16)
+ */
+static size_t kernel_sse2(const unsigned char *str, size_t len, int digits, int *flags)
+{
+    size_t i;
+    for (i = 0; 2 * (i + 16) <= len && *flags; i += 16) {
+        __m128i lo = _mm_loadu_si128((const __m128i *) (str + i));
+        __m128i hi = _mm_loadu_si128((const __m128i *) (str + len - i - 16));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(lo, reverse_sse2(hi))) != 0xFFFF) {
+            *flags &= ~PAL_PALINDROME;
+        }
+        if (digits && !(digits_sse2(lo) && digits_sse2(hi)))  *flags &= ~PAL_NUMBER;
+    }
+    return i;
+}
+
+/** @brief AVX2 kernel: 32 bytes from each end per step.
+ *
+ * The reversal is a byte shuffle within each 128-bit lane followed by a swap
+ * of the lanes.
+ *
+ * @return Bytes consumed from each end (a multiple of 32)
+ */
+__attribute__((target("avx2")))
+static size_t kernel_avx2(const unsigned char *str, size_t len, int digits, int *flags)
+{
+    const __m256i rev = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+                                         15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    const __m256i zero = _mm256_set1_epi8('0');
+    const __m256i nine = _mm256_set1_epi8(9);
+
+    size_t i;
+    for (i = 0; 2 * (i + 32) <= len && *flags; i += 32) {
+        __m256i lo = _mm256_loadu_si256((const __m256i *) (str + i));
+        __m256i hi = _mm256_loadu_si256((const __m256i *) (str + len - i - 32));
+        hi = _mm256_permute2x128_si256(_mm256_shuffle_epi8(hi, rev), hi, 0x01);
+        if ((unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, hi)) != 0xFFFFFFFFu) {
+            *flags &= ~PAL_PALINDROME;
+        }
+        if (digits) {
+            __m256i dl = _mm256_sub_epi8(lo, zero), dh = _mm256_sub_epi8(hi, zero);
+            __m256i ok = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(dl, nine), dl),
+                                          _mm256_cmpeq_epi8(_mm256_min_epu8(dh, nine), dh));
+            if ((unsigned) _mm256_movemask_epi8(ok) != 0xFFFFFFFFu)  *flags &= ~PAL_NUMBER;
+        }
+    }
+    return i;
+}
+#endif
@@ -0,0 +1,22 @@
+#ifndef PALINDROME_H
+#define PALINDROME_H
+
+#include <stddef.h>
+
+// Flags returned by pal_classify
+#define PAL_PALINDROME 1  // The line reads the same backwards (trailing whitespace aside)
+#define PAL_NUMBER 2      // The line only has digits (and newlines)
+
+// Called by pal_maximal for every palindrome found, with its position
+typedef void (*PalMatch)(size_t start, size_t len, void *arg);
+
+int pal_classify(const char *str, size_t len, int digits);
+size_t pal_trim(const char *str, size_t len);
+
+size_t pal_longest(const char *str, size_t len, size_t *start);
+void pal_maximal(const char *str, size_t len, size_t min_len, PalMatch match, void *arg);
+
+int num_check(char *str);
+int str_palindrome(char *str);
+
+#endif
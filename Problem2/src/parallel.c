@@ -0,0 +1,306 @@
+#include "parallel.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// A run of complete lines, and the result of testing them
+typedef struct batch {
+    // Position in the input, to write the batches back in order
+    unsigned long long seq;
+    char *buf;
+    size_t len;
+    size_t size;
+    FilterOut out;
+    FilterSummary summary;
+} Batch;
+
+// Bounded FIFO of batches, shared by threads
+typedef struct queue {
+    Batch **items;
+    int size;
+    int head;
+    int count;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} Queue;
+
+// State shared by the stages of a run
+typedef struct pipeline {
+    int in_fd;
+    DurableFile *out;
+    int num_mode;
+    LineSet *seen;
+    int nthreads;
+    int nbatches;
+    Batch *batches;
+    // Empty batches for the reader, full ones for the workers, tested ones
+    // for the writer. A NULL item tells the next stage the input is over.
+    Queue free;
+    Queue work;
+    Queue done;
+    // Set by the reader or the writer when something failed
+    _Atomic int status;
+} Pipeline;
+
+static void queue_init(Queue *q, int size);
+static void queue_destroy(Queue *q);
+static void queue_push(Queue *q, Batch *b);
+static Batch *queue_pop(Queue *q);
+
+static char *last_newline(char *buf, size_t len);
+
+static void *reader(void *pipe_ptr);
+static void *worker(void *pipe_ptr);
+static void *writer(void *pipe_ptr);
+
+
+/** @brief Filters the palindromes of an input stream into a file on several threads.
+ *
+ * A reader thread cuts the input into batches of about `PARALLEL_BATCH_SIZE`
+ * bytes of whole lines. Worker threads test the lines of each batch with
+ * `filter_block`, and a writer thread writes the accepted lines of each batch
+ * with `writev`, in the order of the input. The batches are recycled through
+ * bounded queues, `PARALLEL_BATCHES_PER_WORKER` per worker, so the memory
+ * used doesn't depend on the size of the input (only on its longest line).
+ * The output is the same as `filter_run`'s, which the input is filtered
+ * with instead if the threads can't be started.
+ *
+ * @param in_fd File descriptor to read lines from.
+ * @param out File to append the palindromes to.
+ * @param num_mode Whether only numbers are accepted (the `-num` option).
+ * @param seen Lines already in the output, to skip, or NULL. Only the writer
+ *             thread uses it, so the first copy of a line is always the one kept.
+ * @param nthreads Number of workers. If 0 or less, one per online CPU.
+ * @param summary Set to the counts of the run.
+ * @return 0 on success, 1 on a read or write error (reported on stderr).
+ */
+int parallel_run(int in_fd, DurableFile *out, int num_mode, LineSet *seen, int nthreads,
+                 FilterSummary *summary)
+{
+    if (nthreads <= 0)  nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads <= 0)  nthreads = 1;
+
+    Pipeline pipe = {
+        .in_fd = in_fd,
+        .out = out,
+        .num_mode = num_mode,
+        .seen = seen,
+        .nthreads = nthreads,
+        .nbatches = nthreads * PARALLEL_BATCHES_PER_WORKER + 2,
+        .status = 0
+    };
+    pipe.batches = calloc(pipe.nbatches, sizeof(Batch));
+    // Every queue can hold all the batches plus the end markers, so pushing never blocks
+    queue_init(&pipe.free, pipe.nbatches + nthreads);
+    queue_init(&pipe.work, pipe.nbatches + nthreads);
+    queue_init(&pipe.done, pipe.nbatches + nthreads);
+    for (int i = 0; i < pipe.nbatches; i++) {
+        pipe.batches[i].size = PARALLEL_BATCH_SIZE;
+        pipe.batches[i].buf = malloc(PARALLEL_BATCH_SIZE);
+        queue_push(&pipe.free, &pipe.batches[i]);
+    }
+
+    // Workers first, then the writer and the reader, so no input is read
+    // unless every stage is running
+    pthread_t read_thread, write_thread;
+    pthread_t *work_threads = calloc(nthreads, sizeof(pthread_t));
+    int nworkers = 0, writing = 0, reading = 0;
+    while (nworkers < nthreads && pthread_create(&work_threads[nworkers], NULL, worker, &pipe) == 0)  nworkers++;
+    pipe.nthreads = nworkers;
+    if (nworkers == nthreads)  writing = pthread_create(&write_thread, NULL, writer, &pipe) == 0;
+    if (writing)  reading = pthread_create(&read_thread, NULL, reader, &pipe) == 0;
+    if (!reading) { // End the stages that did start, as the reader would
+        for (int t = 0; t < nworkers; t++)  queue_push(&pipe.work, NULL);
+    }
+
+    if (reading)  pthread_join(read_thread, NULL);
+    for (int t = 0; t < nworkers; t++)  pthread_join(work_threads[t], NULL);
+    if (writing)  pthread_join(write_thread, NULL);
+
+    memset(summary, 0, sizeof(*summary));
+    for (int i = 0; i < pipe.nbatches; i++) {
+        filter_summary_add(summary, &pipe.batches[i].summary);
+        free(pipe.batches[i].buf);
+        free(pipe.batches[i].out.iov);
+    }
+    free(pipe.batches);
+    free(work_threads);
+    queue_destroy(&pipe.free);
+    queue_destroy(&pipe.work);
+    queue_destroy(&pipe.done);
+
+    if (!reading) {
+        fprintf(stderr, "Can't start the filter threads, filtering serially\n");
+        return filter_run(in_fd, out, num_mode, seen, summary);
+    }
+    return pipe.status;
+}
+
+
+/** @brief Reader stage: fills batches with whole lines, in input order.
+ *
+ * Whatever follows the last newline of a batch is moved to the next one.
+ * A batch with no newline at all is grown until it holds the whole line.
+ */
+static void *reader(void *pipe_ptr)
+{
+    Pipeline *pipe = pipe_ptr;
+    char *carry = NULL;      // Incomplete line left by the last batch
+    size_t ncarry = 0, carry_size = 0;
+    unsigned long long seq = 0;
+
+    int eof = 0;
+    while (!eof) {
+        Batch *b = queue_pop(&pipe->free);
+        if (b->size < ncarry + PARALLEL_BATCH_SIZE) {
+            b->size = ncarry + PARALLEL_BATCH_SIZE;
+            b->buf = realloc(b->buf, b->size);
+        }
+        memcpy(b->buf, carry, ncarry);
+        b->len = ncarry;
+
+        // Read until the batch is full, then keep only whole lines
+        size_t end = 0;
+        for (;;) {
+            if (b->len == b->size) {
+                char *nl = last_newline(b->buf, b->len);
+                if (nl != NULL) {
+                    end = nl - b->buf + 1;
+                    break;
+                }
+                b->buf = realloc(b->buf, b->size *= 2); // A line longer than the batch
+            }
+            ssize_t nread = read(pipe->in_fd, b->buf + b->len, b->size - b->len);
+            if (nread == -1 && errno == EINTR)  continue;
+            if (nread == -1) {
+                perror("Error reading input");
+                pipe->status = 1;
+            }
+            if (nread <= 0) { // The last batch takes everything
+                eof = 1;
+                end = b->len;
+                break;
+            }
+            b->len += nread;
+        }
+
+        ncarry = b->len - end;
+        if (ncarry > carry_size)  carry = realloc(carry, carry_size = ncarry);
+        memcpy(carry, b->buf + end, ncarry);
+        b->len = end;
+        b->seq = seq++;
+        queue_push(&pipe->work, b);
+    }
+
+    free(carry);
+    for (int t = 0; t < pipe->nthreads; t++)  queue_push(&pipe->work, NULL);
+    return NULL;
+}
+
+/** @brief Returns the last newline of a buffer, or NULL if there is none. */
+static char *last_newline(char *buf, size_t len)
+{
+    while (len > 0) {
+        if (buf[--len] == '\n')  return buf + len;
+    }
+    return NULL;
+}
+
+/** @brief Worker stage: tests the lines of each batch. */
+static void *worker(void *pipe_ptr)
+{
+    Pipeline *pipe = pipe_ptr;
+    Batch *b;
+    while ((b = queue_pop(&pipe->work)) != NULL) {
+        // Batches only hold whole lines (the last one may lack its newline)
+        filter_block(b->buf, b->len, 1, pipe->num_mode, &b->summary, &b->out);
+        queue_push(&pipe->done, b);
+    }
+    queue_push(&pipe->done, NULL);
+    return NULL;
+}
+
+/** @brief Writer stage: writes the accepted lines of each batch, in input order.
+ *
+ * Batches finished ahead of their turn wait in a reorder window indexed by
+ * their sequence number. Since there are only `nbatches` batches, two
+ * batches in flight never share a slot.
+ */
+static void *writer(void *pipe_ptr)
+{
+    Pipeline *pipe = pipe_ptr;
+    Batch **window = calloc(pipe->nbatches, sizeof(Batch *));
+    unsigned long long next = 0;
+
+    int nworking = pipe->nthreads;
+    while (nworking > 0) {
+        Batch *b = queue_pop(&pipe->done);
+        if (b == NULL) {
+            nworking--;
+            continue;
+        }
+        window[b->seq % pipe->nbatches] = b;
+
+        while ((b = window[next % pipe->nbatches]) != NULL && b->seq == next) {
+            window[next % pipe->nbatches] = NULL;
+            if (pipe->seen != NULL)  filter_dedup(&b->out, pipe->seen, &b->summary);
+            if (pipe->status == 0 && filter_flush(&b->out, pipe->out))  pipe->status = 1;
+            b->out.n = 0;
+            b->out.nlines = 0;
+            next++;
+            queue_push(&pipe->free, b);
+        }
+    }
+
+    free(window);
+    return NULL;
+}
+
+
+/** @brief Initializes a queue that can hold `size` items. */
+static void queue_init(Queue *q, int size)
+{
+    q->items = malloc(size * sizeof(Batch *));
+    q->size = size;
+    q->head = 0;
+    q->count = 0;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+}
+
+/** @brief Frees the resources of a queue. */
+static void queue_destroy(Queue *q)
+{
+    free(q->items);
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_cond_destroy(&q->not_full);
+}
+
+/** @brief Adds a batch (or NULL) to the end of a queue, waiting for room. */
+static void queue_push(Queue *q, Batch *b)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->count == q->size)  pthread_cond_wait(&q->not_full, &q->lock);
+    q->items[(q->head + q->count++) % q->size] = b;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+/** @brief Takes the batch (or NULL) at the front of a queue, waiting for one. */
+static Batch *queue_pop(Queue *q)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0)  pthread_cond_wait(&q->not_empty, &q->lock);
+    Batch *b = q->items[q->head];
+    q->head = (q->head + 1) % q->size;
+    q->count--;
+    pthread_cond_signal(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+    return b;
+}
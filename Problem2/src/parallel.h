@@ -0,0 +1,14 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "filter.h"
+
+// Bytes of input per batch handed to a worker
+#define PARALLEL_BATCH_SIZE (1024*1024)
+// Batches in flight per worker (being filled, tested or written)
+#define PARALLEL_BATCHES_PER_WORKER 2
+
+int parallel_run(int in_fd, DurableFile *out, int num_mode, LineSet *seen, int nthreads,
+                 FilterSummary *summary);
+
+#endif
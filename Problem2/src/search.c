@@ -0,0 +1,169 @@
+#include "search.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "palindrome.h"
+
+// Size of the blocks read from the input at once
+#define SEARCH_BLOCK_SIZE (1024*1024)
+
+// Where matches are written, and how they are labelled
+typedef struct search_out {
+    DurableFile *df;
+    const char *text;       // String being searched
+    unsigned long long line; // Its line number (from 1), or 0 for the whole input
+    unsigned long long n;   // Matches written so far
+    int status;             // 1 once a write failed
+} SearchOut;
+
+static void search_string(SearchOut *out, const char *str, size_t len, const SearchOptions *opts);
+static void write_match(size_t start, size_t len, void *out_ptr);
+static char *read_all(int fd, size_t *len, int *mapped);
+
+
+/** @brief Searches the palindromic substrings of an input, writing them with their offsets.
+ *
+ * Line by line, every line (without its trailing spaces and newline) is
+ * searched on its own, and matches are written as
+ * `<line>:<offset>:<length>:<palindrome>`, the offset counted from the start
+ * of the line. With `opts->whole`, the input is searched as a single string
+ * (mapped into memory if it is a regular file), and matches are written as
+ * `<offset>:<length>`, the offset counted from the start of the input, since
+ * they may span lines. Each match is one append to `out`, so it is synced
+ * as its durability policy says.
+ *
+ * @param in_fd File descriptor to read from.
+ * @param out File to append the matches to.
+ * @param opts What to look for.
+ * @param nmatches Set to the number of matches written.
+ * @return 0 on success, 1 on a read or write error (reported on stderr).
+ */
+int search_run(int in_fd, DurableFile *out, const SearchOptions *opts, unsigned long long *nmatches)
+{
+    SearchOut so = { .df = out, .text = NULL, .line = 0, .n = 0, .status = 0 };
+    int status = 0;
+
+    if (opts->whole) {
+        size_t len;
+        int mapped;
+        char *data = read_all(in_fd, &len, &mapped);
+        if (data == NULL) {
+            perror("Error reading input");
+            status = 1;
+        }
+        else {
+            search_string(&so, data, len, opts);
+            if (mapped)  munmap(data, len);
+            else  free(data);
+        }
+    }
+    else {
+        FILE *in = fdopen(dup(in_fd), "r");
+        char *line = NULL;
+        size_t nchars = 0;
+        ssize_t len;
+        while ((len = getline(&line, &nchars, in)) != -1) {
+            so.line++;
+            search_string(&so, line, pal_trim(line, len), opts);
+        }
+        if (ferror(in)) {
+            perror("Error reading input");
+            status = 1;
+        }
+        free(line);
+        fclose(in);
+    }
+
+    if (so.status) {
+        fprintf(stderr, "Error writing\n");
+        status = 1;
+    }
+    *nmatches = so.n;
+    return status;
+}
+
+/** @brief Searches one string and writes its matches. */
+static void search_string(SearchOut *out, const char *str, size_t len, const SearchOptions *opts)
+{
+    if (len == 0)  return;
+    out->text = str;
+    if (opts->min_len == 0) {
+        size_t start;
+        size_t n = pal_longest(str, len, &start);
+        write_match(start, n, out);
+    }
+    else {
+        pal_maximal(str, len, opts->min_len, write_match, out);
+    }
+}
+
+/** @brief Writes a match (a `PalMatch` callback).
+ * @param start Offset of the palindrome
+ * @param len Length of the palindrome
+ * @param out_ptr Pointer to the `SearchOut` to write to
+ */
+static void write_match(size_t start, size_t len, void *out_ptr)
+{
+    SearchOut *out = out_ptr;
+    char head[64];
+    struct iovec iov[3] = {
+        { .iov_base = head },
+        { .iov_base = (void *) (out->text + start), .iov_len = len },
+        { .iov_base = "\n", .iov_len = 1 }
+    };
+    int n;
+    if (out->line == 0) {
+        iov[0].iov_len = snprintf(head, sizeof(head), "%zu:%zu\n", start, len);
+        n = 1;
+    }
+    else {
+        iov[0].iov_len = snprintf(head, sizeof(head), "%llu:%zu:%zu:", out->line, start, len);
+        n = 3;
+    }
+    if (durable_writev(out->df, iov, n, 1))  out->status = 1;
+    out->n++;
+}
+
+/** @brief Gets the whole contents of a file descriptor in memory.
+ *
+ * Regular files are mapped, anything else is read in blocks.
+ *
+ * @param fd File descriptor to read.
+ * @param len Set to the length of the contents.
+ * @param mapped Set to 1 if the contents are mapped (free with `munmap`), 0 if
+ *               they were read (free with `free`).
+ * @return The contents, or NULL on a read error.
+ */
+static char *read_all(int fd, size_t *len, int *mapped)
+{
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            *len = st.st_size;
+            *mapped = 1;
+            return data;
+        }
+    }
+
+    size_t size = SEARCH_BLOCK_SIZE, have = 0;
+    char *buf = malloc(size);
+    for (;;) {
+        if (have == size)  buf = realloc(buf, size *= 2);
+        ssize_t nread = read(fd, buf + have, size - have);
+        if (nread == -1 && errno == EINTR)  continue;
+        if (nread == -1) {
+            free(buf);
+            return NULL;
+        }
+        if (nread == 0)  break;
+        have += nread;
+    }
+    *len = have;
+    *mapped = 0;
+    return buf;
+}
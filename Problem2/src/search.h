@@ -0,0 +1,16 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stdio.h>
+#include "durable.h"
+
+// What a search looks for: the longest palindrome, or all the maximal ones
+// at least min_len long
+typedef struct search_options {
+    size_t min_len;  // 0 for the longest palindrome only
+    int whole;       // Search the whole input as one string, not line by line
+} SearchOptions;
+
+int search_run(int in_fd, DurableFile *out, const SearchOptions *opts, unsigned long long *nmatches);
+
+#endif
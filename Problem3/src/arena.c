@@ -0,0 +1,130 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// Allocations are rounded up to this, so they all stay aligned
+#define ARENA_ALIGN (sizeof(max_align_t))
+
+static ArenaChunk *chunk_new(Arena *a, size_t size);
+
+
+/** @brief Initializes an empty arena.
+ * @param a The arena
+ * @param chunk_size Size of its chunks, or 0 for `ARENA_CHUNK_SIZE`.
+ *                   Bigger allocations get a chunk of their own.
+ */
+void arena_init(Arena *a, size_t chunk_size)
+{
+    a->head = NULL;
+    a->chunk_size = chunk_size ? chunk_size : ARENA_CHUNK_SIZE;
+    a->last = NULL;
+}
+
+/** @brief Allocates memory from an arena, bumping a pointer in its current chunk.
+ * @param a The arena
+ * @param size Bytes to allocate
+ * @return The memory, aligned for any type, or NULL if a chunk couldn't be
+ *         allocated. It lives until the arena is reset or freed.
+ */
+void *arena_alloc(Arena *a, size_t size)
+{
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    ArenaChunk *c = a->head;
+    if (c == NULL || c->size - c->used < size) {
+        c = chunk_new(a, size);
+        if (c == NULL)  return NULL;
+    }
+    void *ptr = (char *) c->data + c->used;
+    c->used += size;
+    a->last = ptr;
+    return ptr;
+}
+
+/** @brief Allocates zeroed memory from an arena (see `arena_alloc`). */
+void *arena_calloc(Arena *a, size_t nmemb, size_t size)
+{
+    if (size && nmemb > SIZE_MAX / size)  return NULL;
+    void *ptr = arena_alloc(a, nmemb * size);
+    if (ptr != NULL)  memset(ptr, 0, nmemb * size);
+    return ptr;
+}
+
+/** @brief Grows an allocation of an arena.
+ *
+ * The last allocation is grown in place when its chunk has room, or with
+ * `realloc` of the chunk when it is the only allocation there. Otherwise a
+ * new one is allocated and the data copied, and the old one stays unused
+ * until the arena is reset. A buffer that is grown often should then have
+ * an arena of its own.
+ *
+ * @param a The arena
+ * @param ptr The allocation, or NULL for a new one
+ * @param old_size Its current size
+ * @param new_size Its new size
+ * @return The grown allocation, or NULL if it couldn't be allocated
+ */
+void *arena_grow(Arena *a, void *ptr, size_t old_size, size_t new_size)
+{
+    ArenaChunk *c = a->head;
+    if (ptr != NULL && ptr == a->last) {
+        size_t start = (char *) ptr - (char *) c->data;
+        size_t size = (new_size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+        if (size <= c->size - start) {
+            c->used = start + size;
+            return ptr;
+        }
+        if (start == 0) { // Alone in its chunk, which can move
+            ArenaChunk *grown = realloc(c, sizeof(ArenaChunk) + size);
+            if (grown == NULL)  return NULL;
+            grown->size = grown->used = size;
+            a->head = grown;
+            a->last = grown->data;
+            return grown->data;
+        }
+    }
+    void *grown = arena_alloc(a, new_size);
+    if (grown != NULL && ptr != NULL)  memcpy(grown, ptr, old_size < new_size ? old_size : new_size);
+    return grown;
+}
+
+/** @brief Frees all allocations of an arena at once.
+ *
+ * The current chunk is kept for the next allocations, so an arena reset
+ * after every command stops calling `malloc` once it is big enough.
+ */
+void arena_reset(Arena *a)
+{
+    if (a->head == NULL)  return;
+    ArenaChunk *c = a->head->next;
+    while (c != NULL) {
+        ArenaChunk *next = c->next;
+        free(c);
+        c = next;
+    }
+    a->head->next = NULL;
+    a->head->used = 0;
+    a->last = NULL;
+}
+
+/** @brief Frees an arena and all its chunks. It is left empty, ready to use. */
+void arena_free(Arena *a)
+{
+    arena_reset(a);
+    free(a->head);
+    a->head = NULL;
+}
+
+
+/** @brief Adds a chunk with room for at least `size` bytes as the current one. */
+static ArenaChunk *chunk_new(Arena *a, size_t size)
+{
+    size_t data_size = size > a->chunk_size ? size : a->chunk_size;
+    ArenaChunk *c = malloc(sizeof(ArenaChunk) + data_size);
+    if (c == NULL)  return NULL;
+    c->next = a->head;
+    c->size = data_size;
+    c->used = 0;
+    a->head = c;
+    return c;
+}
@@ -0,0 +1,31 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Default size of the chunks of an arena
+#define ARENA_CHUNK_SIZE (64*1024)
+
+// A chunk of memory allocations are bumped from
+typedef struct arena_chunk {
+    struct arena_chunk *next;  // Older chunk
+    size_t size;               // Bytes in data
+    size_t used;
+    max_align_t data[];
+} ArenaChunk;
+
+// A region allocator: allocations are never freed one by one, only all at once
+typedef struct arena {
+    ArenaChunk *head;   // Chunk allocations are taken from
+    size_t chunk_size;
+    void *last;         // Last allocation, which can be grown in place
+} Arena;
+
+void arena_init(Arena *a, size_t chunk_size);
+void *arena_alloc(Arena *a, size_t size);
+void *arena_calloc(Arena *a, size_t nmemb, size_t size);
+void *arena_grow(Arena *a, void *ptr, size_t old_size, size_t new_size);
+void arena_reset(Arena *a);
+void arena_free(Arena *a);
+
+#endif
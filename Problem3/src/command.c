@@ -0,0 +1,183 @@
+#include "command.h"
+#include "../../Problem1/src/strutils.h"
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+
+// A registered operation
+typedef struct op {
+    const char *name;
+    size_t name_len;
+    OpFunc apply;
+} Op;
+
+static int parse_count(const Span *tok, long *n);
+
+// Registered operations
+static Op ops[OPS_MAX];
+static int nops = 0;
+
+
+/** @brief Registers an operation, so commands can use it by name.
+ * @param name Name of the operation (kept, not copied)
+ * @param apply Function applying it
+ * @return 0 if it was registered, 1 if the table is full or the name is taken
+ */
+int op_register(const char *name, OpFunc apply)
+{
+    if (nops == OPS_MAX || op_find(name, strlen(name)) != NULL)  return 1;
+    ops[nops].name = name;
+    ops[nops].name_len = strlen(name);
+    ops[nops].apply = apply;
+    nops++;
+    return 0;
+}
+
+/** @brief Finds a registered operation by name.
+ * @param name Name to look for (it needn't be `'\0'`-terminated)
+ * @param len Length of the name
+ * @return The function applying the operation, or NULL if there is none
+ */
+OpFunc op_find(const char *name, size_t len)
+{
+    for (int i = 0; i < nops; i++) {
+        if (ops[i].name_len == len && memcmp(ops[i].name, name, len) == 0)  return ops[i].apply;
+    }
+    return NULL;
+}
+
+/** @brief Registers the built-in operations: `toupper` and `tolower`. */
+void ops_register_defaults(void)
+{
+    op_register("toupper", memupper);
+    op_register("tolower", memlower);
+}
+
+
+/** @brief Splits a command line into tokens separated by spaces, in one pass.
+ *
+ * Tokens are recorded as spans of `line`, nothing is copied. Runs of spaces
+ * count as one separator.
+ *
+ * @param scratch Arena to allocate the spans from.
+ * @param line The command line (it needn't be `'\0'`-terminated).
+ * @param len Length of the line.
+ * @param tokens Set to the spans, valid until the arena is reset.
+ * @return The number of tokens.
+ */
+size_t tokenize(Arena *scratch, const char *line, size_t len, Span **tokens)
+{
+    size_t n = 0, size = 0;
+    *tokens = NULL;
+    for (size_t i = 0; i < len; ) {
+        if (line[i] == ' ') {
+            i++;
+            continue;
+        }
+        const char *end = memchr(line + i, ' ', len - i);
+        size_t tok_len = end != NULL ? (size_t) (end - line) - i : len - i;
+
+        if (n == size) {
+            size = size ? 2 * size : 16;
+            *tokens = arena_grow(scratch, *tokens, n * sizeof(Span), size * sizeof(Span));
+        }
+        (*tokens)[n].ptr = line + i;
+        (*tokens)[n].len = tok_len;
+        n++;
+        i += tok_len;
+    }
+    return n;
+}
+
+
+/** @brief Runs a command, appending its result and a newline to a buffer.
+ *
+ * A command is `<operation> <numStrings> <string>...`, with exactly
+ * `numStrings` strings. The result is the strings separated by single
+ * spaces, transformed by the operation. They are transformed straight from
+ * the command line into `out`, with no copies in between, and strings that
+ * are already one space apart are transformed in a single call.
+ *
+ * @param scratch Arena for the tokens. It can be reset once this returns.
+ * @param line The command line, without its newline.
+ * @param len Length of the line.
+ * @param out Buffer to append the result to. It is left as is on errors.
+ * @return
+ * * 0 if the command was run,
+ * * 1 if the operation doesn't exist,
+ * * 2 if the number of strings is invalid or doesn't match, or
+ * * 3 if `out` couldn't grow to hold the result
+ */
+int execute_command(Arena *scratch, const char *line, size_t len, OutBuf *out)
+{
+    Span *tokens;
+    size_t ntok = tokenize(scratch, line, len, &tokens);
+    if (ntok == 0)  return 1;
+
+    // Reading `operation`
+    OpFunc op = op_find(tokens[0].ptr, tokens[0].len);
+    if (op == NULL)  return 1; // Invalid operation
+
+    // Reading `numStrings`, which must match the strings given
+    long n;
+    if (ntok < 2 || parse_count(&tokens[1], &n) || (size_t) n != ntok - 2)  return 2;
+
+    // Applying the operation. Strings already one space apart are applied in
+    // one go (spaces are left as they are by the operations).
+    size_t total = ntok - 2; // Spaces between strings and the newline
+    for (size_t i = 2; i < ntok; i++)  total += tokens[i].len;
+    char *dst = outbuf_reserve(out, total);
+    if (dst == NULL)  return 3;
+    for (size_t i = 2, j; i < ntok; i = j) {
+        if (i > 2)  *dst++ = ' ';
+        const char *src = tokens[i].ptr;
+        for (j = i + 1; j < ntok && tokens[j].ptr == tokens[j-1].ptr + tokens[j-1].len + 1; j++);
+        size_t run = tokens[j-1].ptr + tokens[j-1].len - src;
+        op(dst, src, run);
+        dst += run;
+    }
+    *dst = '\n';
+    out->len += total;
+    return 0;
+}
+
+/** @brief Parses the number of strings of a command (a positive integer).
+ * @return 0 if it is valid, 1 otherwise
+ */
+static int parse_count(const Span *tok, long *n)
+{
+    *n = 0;
+    size_t i = tok->len > 1 && tok->ptr[0] == '+'; // Optional sign, as strtol takes
+    for (; i < tok->len; i++) {
+        if (!isdigit((unsigned char) tok->ptr[i]) || *n > LONG_MAX / 10 - 1)  return 1;
+        *n = *n * 10 + (tok->ptr[i] - '0');
+    }
+    return *n < 1;
+}
+
+
+/** @brief Initializes an empty buffer, growing in the given arena. */
+void outbuf_init(OutBuf *out, Arena *arena)
+{
+    out->data = NULL;
+    out->len = 0;
+    out->size = 0;
+    out->arena = arena;
+}
+
+/** @brief Makes room for `n` more bytes at the end of a buffer.
+ * @return Where to write them, or NULL if the buffer couldn't grow (it is
+ *         left as is). `out->len` is not updated.
+ */
+char *outbuf_reserve(OutBuf *out, size_t n)
+{
+    if (out->len + n > out->size) {
+        size_t size = out->size ? out->size : 1024;
+        while (out->len + n > size)  size *= 2;
+        char *data = arena_grow(out->arena, out->data, out->len, size);
+        if (data == NULL)  return NULL;
+        out->data = data;
+        out->size = size;
+    }
+    return out->data + out->len;
+}
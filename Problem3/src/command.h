@@ -0,0 +1,37 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <stddef.h>
+#include "arena.h"
+
+// Most operations that can be registered
+#define OPS_MAX 32
+
+// An operation: transforms `len` bytes of `src` into `dst` (which may be `src`)
+typedef void (*OpFunc)(char *dst, const char *src, size_t len);
+
+// A token of a command, in place in the command line
+typedef struct span {
+    const char *ptr;
+    size_t len;
+} Span;
+
+// Growable buffer the results are appended to
+typedef struct outbuf {
+    char *data;
+    size_t len;
+    size_t size;
+    Arena *arena;  // Arena it grows in
+} OutBuf;
+
+int op_register(const char *name, OpFunc apply);
+OpFunc op_find(const char *name, size_t len);
+void ops_register_defaults(void);
+
+size_t tokenize(Arena *scratch, const char *line, size_t len, Span **tokens);
+int execute_command(Arena *scratch, const char *line, size_t len, OutBuf *out);
+
+void outbuf_init(OutBuf *out, Arena *arena);
+char *outbuf_reserve(OutBuf *out, size_t n);
+
+#endif
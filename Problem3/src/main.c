@@ -3,168 +3,61 @@
 #include <stdarg.h>
 #include <string.h>
 #include <unistd.h>
-#include <ctype.h>
 #include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/signalfd.h>
+#include "../../Problem2/src/durable.h"
+#include "command.h"
+#include "server.h"
 
-#define BUFFER_SIZE 1024
-
-
-// ptrlist
-typedef struct ptrlist {
-    void **ptr;
-    struct ptrlist *next;
-} ptrlist_t;
-
-/** @brief Appends an element onto the given pointer list 
- * @param head Head to the pointer list
- * @param ptr Pointer to append
- * @return The head to the updated pointer list
- */
-ptrlist_t *ptrlist_append(ptrlist_t *head, void *ptr ) {
-    if (head == NULL)  head = calloc(1, sizeof(ptrlist_t));
-    if (head->ptr == NULL)  head->ptr = ptr;
-    else {
-        ptrlist_t *new = malloc(sizeof(ptrlist_t));
-        new->ptr = ptr;
-        new->next = head->next;
-        head->next = new;
-    }
-    return head;
-}
-
-/** @brief Replace the first occurence of the old pointer with a new pointer 
- * @param head Head of the pointer list
- * @param ptr_old Old pointer (to be removed)
- * @param ptr_new New pointer
- * @return 0 if the list was updated, 1 otherwise
- */
-int ptrlist_replace(ptrlist_t *head, void *ptr_old, void *ptr_new) {
-    for(ptrlist_t *curr = head; curr->ptr != NULL; curr = curr->next) {
-        if (curr->ptr == ptr_old) {
-            curr->ptr = ptr_new;
-            return 0;
-        }
-        if (curr->next == NULL)  break;
-    }
-    return 1;
-}
-
-int ptrlist_remove(ptrlist_t *head, void *ptr) {
-    ptrlist_t *last = NULL;
-    for(ptrlist_t *curr = head; curr->ptr != NULL; curr = curr->next) {
-        if (curr->ptr == ptr) {
-            if (curr == head){
-                if (curr->next == NULL)  curr->ptr = NULL;
-                else {
-                    curr->ptr = curr->next->ptr;
-                    curr->next = curr->next->next;
-                }
-            }
-            else  last->next = curr->next;
-            return 0;
-        }
-        if (curr->next == NULL)  break;
-        last = curr;
-    }
-    return 1;
-}
-
-/** @brief Executes the given operation on each pointer in the given list
- * @param head Head of the pointer list
- * @param operation Function that will accept the pointers
- */
-void ptrlist_op(ptrlist_t *head, void (*operation)(void *)) {
-    if (head == NULL)  return;
-    for(ptrlist_t *curr = head; curr->ptr != NULL; curr = curr->next) {
-        operation(curr->ptr);
-        if (curr->next == NULL)  break;
-    }
-}
+// Size of the reads from stdin, and of the batches of results written
+#define STREAM_BLOCK_SIZE (1024*1024)
+// Time without user commands after which an interactive session ends
+#define IDLE_TIMEOUT_MS 10000
 
 
 void exiterrf(char *format, ...);
 
-void *mallocr(size_t size);
-void *callocr(size_t nmemb, size_t msize);
-FILE *fopenr(char *fpath, char* mode);
 int freeall();
 int fcloseall();
 
 int check_file(char *fpath);
-int command_loop(FILE *output);
-int execute_command(char *line, FILE *output);
+int command_loop(DurableFile *output, int sigfd, int idle_ms);
 void terminate(int sig);
+static long long now_ms(void);
 
 
 // Global variables.
-static ptrlist_t *ptrs = NULL; // Pointers to be freed
-static ptrlist_t *openfiles = NULL; // Files to be closed
-
-/** @brief Mallocs the specified space and registers it to `ptrs`
- * @param size 
- * @return The pointer to the allocated memory space
- */
-void *mallocr(size_t size)
-{
-    void *ptr = malloc(size);
-    ptrs = ptrlist_append(ptrs, ptr);
-    return ptr;
-}
-/** @brief Callocs the specified space and registers it to `ptrs`
- * @param nmemb 
- * @param msize 
- * @return The pointer to the allocated memory space
- */
-void *callocr(size_t nmemb, size_t msize)
-{
-    void *ptr = calloc(nmemb, msize);
-    ptrs = ptrlist_append(ptrs, ptr);
-    return ptr;
-}
-
-void freer(void *ptr) {
-    ptrlist_remove(ptrs, ptr);
-    free(ptr);
-}
-
-/** @brief Opens a file and registers it to `openfiles`
- * @param fpath File path
- * @param mode Opening mode (see `fopen`)
- * @return The file pointer
- */
-FILE *fopenr(char *fpath, char* mode)
-{
-    FILE *fp = fopen(fpath, mode);
-    openfiles = ptrlist_append(openfiles, fp);
-    return fp;
-}
+static Arena heap = { NULL, ARENA_CHUNK_SIZE, NULL }; // Memory kept until the end
+static Arena outheap = { NULL, ARENA_CHUNK_SIZE, NULL }; // The results, apart so they grow in place
+static Arena scratch = { NULL, ARENA_CHUNK_SIZE, NULL }; // Memory of the current command, reset after it
+static DurableFile *outfile = NULL; // Output file, closed with the others
+static DurablePolicy policy = { .mode = DURABLE_NONE, .n = 0 }; // Its durability policy
+static DurableStats outstats; // Its statistics, once closed
+static OutBuf results; // Results of the last commands
 
 
-/** @brief Frees all pointers in the ptrs list and empties it
+/** @brief Frees all memory at once, by freeing the arenas
  * @return 0 (no error)
  */
 int freeall()
 {
-    ptrlist_op(ptrs, free);
-    if(ptrs != NULL)  free(ptrs);
-    ptrs = NULL;
+    arena_free(&scratch);
+    arena_free(&outheap);
+    arena_free(&heap);
     return 0;
 }
 
-/** @brief Closes the given file pointer, accepting a `void *` parameter and casting it.
- * @param fp File pointer, expected to be castable to `FILE *`
- */
-void fclosev(void *fp) {
-    fclose((FILE *)fp);
-}
-/** @brief Closes all file pointers in the openfiles list and empties it
- * @return 0 (no error)
+/** @brief Closes the output file
+ * @return 0 (no error), or 1 if the output file couldn't be written
  */
 int fcloseall() {
-    ptrlist_op(openfiles, fclosev);
-    if (openfiles!=NULL)  free(openfiles);
-    openfiles = NULL;
-    return 0;
+    int status = 0;
+    if (outfile != NULL)  status = durable_close(outfile, &outstats);
+    outfile = NULL;
+    return status;
 }
 
 
@@ -183,23 +76,59 @@ void exiterrf(char *format, ...)
 
 int main(int argc, char **argv)
 {
-    // Check arg count
-    if (argc != 2)  exiterrf("%s requires exactly 1 argument (%d provided)\n", argv[0], argc - 1);
+    // Check arg count, and the options: durability policy and server socket
+    if (argc < 2 || argc > 4)  exiterrf("%s requires 1 to 3 arguments (%d provided)\n", argv[0], argc - 1);
+    char *sockpath = NULL;
+    for (int i = 2; i < argc; i++) {
+        if (strncmp(argv[i], "-sync=", 6) == 0 && !durable_parse(argv[i] + 6, &policy))  continue;
+        if (strncmp(argv[i], "-listen=", 8) == 0 && argv[i][8] != '\0') {
+            sockpath = argv[i] + 8;
+            continue;
+        }
+        exiterrf("Wrong option '%s' (-sync=none|each|lines:<n>|ms:<n> or -listen=<socket> expected)\n", argv[i]);
+    }
 
-    // Attach signal handlers
-    signal(SIGINT, terminate);
-    signal(SIGALRM, terminate);
+    // Take SIGINT and SIGTERM through a file descriptor, so the command loop
+    // stops at a safe point instead of terminating from a handler. They must
+    // be blocked before any thread is created, so every thread inherits it.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    int sigfd;
+    if (sigprocmask(SIG_BLOCK, &signals, NULL) == -1 || (sigfd = signalfd(-1, &signals, SFD_CLOEXEC)) == -1) {
+        exiterrf("Can't set up the signal handling\n");
+    }
 
     // Get filepath from argument, check and open file.
     char *fpath = argv[1];
     if (check_file(fpath))  exiterrf("Invalid file '%s'. Check existence and permissions\n", fpath);
 
-    FILE *fp = fopenr(fpath, "a");
+    outfile = durable_open(fpath, &policy);
+    if (outfile == NULL)  exiterrf("Can't open file '%s'\n", fpath);
+
+    // Server mode: commands come from the clients of a socket
+    ops_register_defaults();
+    if (sockpath != NULL) {
+        ServerStats stats;
+        int sig = server_run(sockpath, outfile, sigfd, &stats);
+        if (sig == -1)  exiterrf("Can't listen on '%s'\n", sockpath);
+        printf("Served %llu commands (%llu not supported) from %llu clients, in %llu appends\n",
+               stats.commands, stats.rejected, stats.clients, stats.appends);
+        close(sigfd);
+        terminate(sig ? sig : SIGINT);
+    }
 
     // Command loop. It needs the file to write the results.
-    command_loop(fp);
-
-    terminate(SIGINT);
+    // Commands are typed by a user, or streamed from a pipe or file.
+    // Only users get the idle timeout, a pipe or file is read as fast as possible.
+    int idle_ms = -1;
+    if (isatty(STDIN_FILENO))  idle_ms = IDLE_TIMEOUT_MS;
+    else  setvbuf(stdout, NULL, _IOFBF, STREAM_BLOCK_SIZE);
+    int sig = command_loop(outfile, sigfd, idle_ms);
+
+    close(sigfd);
+    terminate(sig ? sig : SIGINT);
 }
 
 
@@ -223,62 +152,128 @@ int check_file(char *fpath)
 }
 
 
-int command_loop(FILE *output)
+/** @brief Runs the commands read from stdin, until it ends, a signal comes or it idles.
+ *
+ * The loop waits with `poll` on both stdin and `sigfd`, so signals are
+ * handled here, between two reads, and never interrupt a write. Commands
+ * are parsed from blocks of up to `STREAM_BLOCK_SIZE`, and the results of
+ * a block are written together: one append to the output file and one
+ * write to stdout, with the "Not Supported" messages in their place. A user
+ * typically sends one line per read, and a pipe or file many. A line that
+ * the buffer can't grow to hold gets "Not Supported" and is skipped, and
+ * the loop stops if the results can't grow.
+ *
+ * @param output The file to write the results to
+ * @param sigfd Signal file descriptor for the signals that stop the loop
+ * @param idle_ms Time without input after which the loop stops, or -1 for none
+ * @return Why the loop stopped: 0 at the end of stdin, the signal number
+ *         when a signal came, `SIGALRM` when it idled, or `SIGILL` when it ran
+ *         out of memory
+ */
+int command_loop(DurableFile *output, int sigfd, int idle_ms)
 {
-    size_t nchars = BUFFER_SIZE;
-    char *line = mallocr(sizeof(char)*nchars);
-
-    while (!feof(stdin)) {
-        alarm(10);
-        char *old_line = line;
-        if(getline(&line, &nchars, stdin) == -1 || line[0] == '\n')  continue;
-        if (line != old_line)  ptrlist_replace(ptrs, old_line, line);
-
-        line[strlen(line)-1] = '\0';
+    size_t size = STREAM_BLOCK_SIZE;
+    char *buf = arena_alloc(&heap, size);
+    size_t len = 0; // Bytes in buf, the start of a line
+    int eof = 0;
+    int skipping = 0; // Discarding the rest of a line too long to hold
+    int nomem = 0;
+    struct pollfd fds[2] = { { STDIN_FILENO, POLLIN, 0 }, { sigfd, POLLIN, 0 } };
+    long long deadline = now_ms() + idle_ms;
+    outbuf_init(&results, &outheap);
+
+    while (!eof) {
+        // Wait for input, a signal or the end of the idle time
+        int timeout = idle_ms < 0 ? -1 : deadline > now_ms() ? (int) (deadline - now_ms()) : 0;
+        int ready = poll(fds, 2, timeout);
+        if (ready == -1 && errno == EINTR)  continue;
+        if (ready == 0)  return SIGALRM;
+        if (fds[1].revents & POLLIN) {
+            struct signalfd_siginfo info;
+            if (read(sigfd, &info, sizeof(info)) == sizeof(info))  return info.ssi_signo;
+        }
+        if (!(fds[0].revents & (POLLIN | POLLHUP | POLLERR | POLLNVAL)))  continue;
+
+        if (len == size) { // A line longer than the buffer
+            char *grown = arena_grow(&heap, buf, size, size * 2);
+            if (grown == NULL) { // Too long to hold: reject it and skip the rest
+                fputs("Not Supported\n", stdout);
+                len = 0;
+                skipping = 1;
+            }
+            else {
+                buf = grown;
+                size *= 2;
+            }
+        }
+        ssize_t nread = read(STDIN_FILENO, buf + len, size - len);
+        if (nread == -1 && errno == EINTR)  continue;
+        deadline = now_ms() + idle_ms;
+        if (nread <= 0) { // The last line may lack its newline
+            eof = 1;
+            if (len == 0)  break;
+            buf[len++] = '\n';
+        }
+        else if (skipping) { // Nothing is kept until the end of the rejected line
+            char *nl = memchr(buf, '\n', nread);
+            if (nl == NULL)  continue;
+            len = buf + nread - (nl + 1);
+            memmove(buf, nl + 1, len);
+            skipping = 0;
+        }
+        else  len += nread;
+
+        // Run the complete lines
+        results.len = 0;
+        size_t echoed = 0; // Results already sent to stdout
+        unsigned long long nlines = 0;
+        char *line = buf, *end = buf + len, *nl;
+        for (; (nl = memchr(line, '\n', end - line)) != NULL; line = nl + 1) {
+            if (nl == line)  continue;
+            arena_reset(&scratch);
+            int err = execute_command(&scratch, line, nl - line, &results);
+            if (err == 3) { // The results can't grow: stop after the ones run so far
+                nomem = 1;
+                break;
+            }
+            if (err > 0) {
+                fwrite(results.data + echoed, 1, results.len - echoed, stdout);
+                fputs("Not Supported\n", stdout);
+                echoed = results.len;
+            }
+            else  nlines++;
+        }
 
-        if (execute_command(line, output) > 0)  printf("Not Supported\n");
+        // Write the batch, and keep the incomplete line for the next read
+        fwrite(results.data + echoed, 1, results.len - echoed, stdout);
+        if (nlines && durable_write(output, results.data, results.len, nlines))  printf("Error writing\n");
+        if (nomem) {
+            fprintf(stderr, "Out of memory for the results\n");
+            return SIGILL;
+        }
+        len = end - line;
+        memmove(buf, line, len);
     }
 
     return 0;
 }
 
-
-int execute_command(char *line, FILE *output)
+/** @brief Returns a monotonic timestamp in milliseconds. */
+static long long now_ms(void)
 {
-    // Reading `operation`
-    const char *tok = strtok(line, " ");
-    int (* op)(int) = !strcmp(tok, "toupper") ? toupper : !strcmp(tok, "tolower")? tolower : NULL;
-    if (op == NULL)  return 1; // Invalid operation
-
-    // Reading `numStrings`
-    const char *strn = strtok(NULL, " ");
-    char *end;
-    const long n = strtol(strn, &end, 10);
-    if (n<1 || end[0] != '\0')  return 2; // Invalid number
-
-    // Reading strings
-    char lineout[BUFFER_SIZE] = {0};
-    char *str;
-    int linelen = 0;
-    for (int i=0; i < n; i++) {
-        if ((str = strtok(NULL, " ")) == 0)  return 2; // Check for n too big
-        if (linelen > 1)  lineout[linelen++] = ' '; // Add spaces between strings
-        strcpy(lineout + linelen*sizeof(char), str); // Save string
-        linelen += strlen(str); // Add line length
-    }
-    if (strtok(NULL, " "))  return 2; // Check for n too small
-
-    // Apply operation
-    for (int i = 0; lineout[i] != '\0'; i++)  lineout[i] = op(lineout[i]);
-
-    // Print and write to file
-    printf("%s\n", lineout);
-    fprintf(output, "%s\n", lineout);
-
-    return 0;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
 }
 
 
+/** @brief Closes the file, frees everything and exits, reporting why.
+ *
+ * It is called from the normal flow of the program, never from a signal
+ * handler, so it is free to use stdio and the allocators.
+ *
+ * @param sig `SIGALRM` if the user was idle, `SIGILL` on errors, or the signal that stopped it
+ */
 void terminate(int sig)
 {
     if (sig == SIGALRM)  printf("->No user commands in 10 seconds. Exiting\n");
@@ -286,6 +281,7 @@ void terminate(int sig)
     
     // Watch out, these printf statements include important function calls
     printf("Closing files... %s.\n",     fcloseall()?  "Error":"Done");
+    if (policy.mode != DURABLE_NONE)  durable_report(&outstats, &policy, stdout);
     printf("Freeing pointers... %s.\n",  freeall()?    "Error":"Done");
 
     printf("Terminated\n");
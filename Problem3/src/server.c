@@ -0,0 +1,356 @@
+#include "server.h"
+#include "command.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/signalfd.h>
+
+// Reply to a command that can't be run
+static const char not_supported[] = "Not Supported\n";
+
+// A connected client
+typedef struct client {
+    int fd;
+    Arena in_arena;   // Buffers of the client, each alone in its arena so
+    Arena out_arena;  // it grows in place, freed when it leaves
+    char *in;         // Commands read, the start of a line
+    size_t in_len;
+    size_t in_size;
+    int skipping;     // Discarding the rest of a line over SERVER_LINE_MAX
+    OutBuf out;       // Replies not sent yet
+    size_t out_sent;
+    int closing;      // No more commands, close once the replies are sent
+    uint32_t events;  // Events it is registered for
+    struct client *prev, *next;
+} Client;
+
+// State of the server, shared by all clients
+typedef struct server {
+    int epfd;
+    int listen_fd;
+    int sigfd;
+    DurableFile *output;
+    Arena heap;        // The batch
+    Arena scratch;     // Tokens of the command being run
+    OutBuf batch;      // Results not appended to the file yet
+    unsigned long long batch_lines;
+    Client *clients;
+    ServerStats stats;
+} Server;
+
+static int server_accept(Server *s);
+static void server_flush(Server *s);
+static Client *client_new(Server *s, int fd);
+static void client_read(Server *s, Client *c);
+static int client_run(Server *s, Client *c);
+static int client_reply(Client *c, const char *reply, size_t len);
+static void client_send(Server *s, Client *c);
+static void client_update(Server *s, Client *c);
+static void client_close(Server *s, Client *c);
+static int set_nonblocking(int fd);
+
+
+/** @brief Serves commands from many clients over a Unix domain socket.
+ *
+ * Clients connect to `path` and send commands, one per line, as they would
+ * type them. Each one gets a reply per command, in order: the result, or
+ * "Not Supported". Everything runs in one thread around `epoll`, so the
+ * results of all clients go to the file through a single writer: those of
+ * a round of events are appended together, before their replies are sent.
+ * A line is printed once the socket is ready.
+ *
+ * @param path Path of the socket. A socket left there is replaced.
+ * @param output The file to append the results to
+ * @param sigfd Signal file descriptor for the signals that stop the server
+ * @param stats Set to what the server did
+ * @return The signal that stopped it, or -1 if the socket couldn't be set up
+ */
+int server_run(const char *path, DurableFile *output, int sigfd, ServerStats *stats)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path))  return -1;
+    strcpy(addr.sun_path, path);
+
+    Server s = { .sigfd = sigfd, .output = output };
+    arena_init(&s.heap, 0);
+    arena_init(&s.scratch, 0);
+    outbuf_init(&s.batch, &s.heap);
+
+    struct stat st; // Replace a socket left behind, but nothing else
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))  unlink(path);
+    s.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    s.epfd = epoll_create1(0);
+    if (s.listen_fd == -1 || s.epfd == -1 || set_nonblocking(s.listen_fd)
+        || bind(s.listen_fd, (struct sockaddr *) &addr, sizeof(addr)) == -1
+        || listen(s.listen_fd, SOMAXCONN) == -1) {
+        if (s.listen_fd != -1)  close(s.listen_fd);
+        if (s.epfd != -1)  close(s.epfd);
+        return -1;
+    }
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    epoll_ctl(s.epfd, EPOLL_CTL_ADD, s.listen_fd, &ev);
+    ev.data.ptr = &s;
+    epoll_ctl(s.epfd, EPOLL_CTL_ADD, sigfd, &ev);
+    printf("Listening on '%s'\n", path);
+    fflush(stdout);
+
+    int sig = 0;
+    struct epoll_event events[SERVER_EVENTS];
+    while (!sig) {
+        int n = epoll_wait(s.epfd, events, SERVER_EVENTS, -1);
+        if (n == -1 && errno != EINTR)  break;
+
+        // Run what the clients sent, gathering their results
+        for (int i = 0; i < n; i++) {
+            void *ptr = events[i].data.ptr;
+            if (ptr == NULL)  server_accept(&s);
+            else if (ptr == &s) {
+                struct signalfd_siginfo info;
+                if (read(sigfd, &info, sizeof(info)) == sizeof(info))  sig = info.ssi_signo;
+            }
+            else if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))  client_read(&s, ptr);
+        }
+
+        // Append the results of the round, then reply
+        server_flush(&s);
+        for (Client *c = s.clients, *next; c != NULL; c = next) {
+            next = c->next;
+            client_send(&s, c);
+        }
+    }
+
+    // Whatever was run is appended and replied to, as far as clients take it
+    server_flush(&s);
+    for (Client *c = s.clients, *next; c != NULL; c = next) {
+        next = c->next;
+        c->closing = 1;
+        client_send(&s, c);
+    }
+    while (s.clients != NULL)  client_close(&s, s.clients);
+    close(s.listen_fd);
+    close(s.epfd);
+    unlink(path);
+    arena_free(&s.scratch);
+    arena_free(&s.heap);
+
+    *stats = s.stats;
+    return sig;
+}
+
+
+/** @brief Accepts all pending connections.
+ * @return 0, or 1 if a connection couldn't be accepted
+ */
+static int server_accept(Server *s)
+{
+    int fd;
+    while ((fd = accept(s->listen_fd, NULL, NULL)) != -1) {
+        if (set_nonblocking(fd) || client_new(s, fd) == NULL) {
+            close(fd);
+            return 1;
+        }
+    }
+    return errno != EAGAIN && errno != EWOULDBLOCK;
+}
+
+/** @brief Appends the gathered results to the file, in one write. */
+static void server_flush(Server *s)
+{
+    if (s->batch_lines == 0)  return;
+    if (durable_write(s->output, s->batch.data, s->batch.len, s->batch_lines)) {
+        fprintf(stderr, "Error writing\n");
+    }
+    s->stats.appends++;
+    s->batch.len = 0;
+    s->batch_lines = 0;
+}
+
+
+/** @brief Registers a new client, listening for its commands. */
+static Client *client_new(Server *s, int fd)
+{
+    Client *c = calloc(1, sizeof(Client));
+    if (c == NULL)  return NULL;
+    c->fd = fd;
+    arena_init(&c->in_arena, 0);
+    arena_init(&c->out_arena, 0);
+    c->in_size = SERVER_READ_SIZE;
+    c->in = arena_alloc(&c->in_arena, c->in_size);
+    outbuf_init(&c->out, &c->out_arena);
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+    if (c->in == NULL || epoll_ctl(s->epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        arena_free(&c->in_arena);
+        free(c);
+        return NULL;
+    }
+    c->events = EPOLLIN;
+    c->next = s->clients;
+    if (s->clients != NULL)  s->clients->prev = c;
+    s->clients = c;
+    s->stats.clients++;
+    return c;
+}
+
+/** @brief Reads what a client sent and runs its complete commands.
+ *
+ * One read per call, so a busy client can't starve the others. A line that
+ * reaches `SERVER_LINE_MAX` bytes is rejected and the rest of it skipped.
+ * The client is closed if its buffers can't grow.
+ */
+static void client_read(Server *s, Client *c)
+{
+    if (c->in_len == c->in_size && c->in_size >= SERVER_LINE_MAX) { // Too long to run
+        if (client_reply(c, not_supported, sizeof(not_supported) - 1)) {
+            client_close(s, c);
+            return;
+        }
+        s->stats.commands++;
+        s->stats.rejected++;
+        c->in_len = 0;
+        c->skipping = 1;
+    }
+    else if (c->in_len == c->in_size) { // A line longer than the buffer
+        char *in = arena_grow(&c->in_arena, c->in, c->in_size, 2 * c->in_size);
+        if (in == NULL) {
+            client_close(s, c);
+            return;
+        }
+        c->in = in;
+        c->in_size *= 2;
+    }
+    ssize_t nread = read(c->fd, c->in + c->in_len, c->in_size - c->in_len);
+    if (nread == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))  return;
+    if (nread <= 0) { // The last line may lack its newline
+        if (c->in_len > 0)  c->in[c->in_len++] = '\n';
+        c->closing = 1;
+    }
+    else if (c->skipping) { // Nothing is kept until the end of the rejected line
+        char *nl = memchr(c->in, '\n', nread);
+        if (nl == NULL)  return;
+        c->in_len = c->in + nread - (nl + 1);
+        memmove(c->in, nl + 1, c->in_len);
+        c->skipping = 0;
+    }
+    else  c->in_len += nread;
+
+    if (client_run(s, c)) {
+        client_close(s, c);
+        return;
+    }
+    client_update(s, c);
+}
+
+/** @brief Runs the complete commands of a client.
+ *
+ * Results go to the batch, and a copy of each (or "Not Supported") to the
+ * replies of the client.
+ *
+ * @return 0, or 1 if the batch or the replies couldn't grow
+ */
+static int client_run(Server *s, Client *c)
+{
+    char *line = c->in, *end = c->in + c->in_len, *nl;
+    for (; (nl = memchr(line, '\n', end - line)) != NULL; line = nl + 1) {
+        if (nl == line)  continue;
+        arena_reset(&s->scratch);
+        size_t start = s->batch.len;
+        const char *reply = not_supported;
+        size_t reply_len = sizeof(not_supported) - 1;
+        int err = execute_command(&s->scratch, line, nl - line, &s->batch);
+        if (err == 3)  return 1;
+        if (err == 0) {
+            reply = s->batch.data + start;
+            reply_len = s->batch.len - start;
+            s->batch_lines++;
+        }
+        else  s->stats.rejected++;
+        s->stats.commands++;
+
+        if (client_reply(c, reply, reply_len))  return 1;
+        if (s->batch.len >= SERVER_BATCH_SIZE)  server_flush(s);
+    }
+    c->in_len = end - line;
+    memmove(c->in, line, c->in_len);
+    return 0;
+}
+
+/** @brief Adds a reply to those a client has pending.
+ * @return 0, or 1 if its replies couldn't grow
+ */
+static int client_reply(Client *c, const char *reply, size_t len)
+{
+    char *dst = outbuf_reserve(&c->out, len);
+    if (dst == NULL)  return 1;
+    memcpy(dst, reply, len);
+    c->out.len += len;
+    return 0;
+}
+
+/** @brief Sends a client as much of its replies as it takes.
+ *
+ * The client is closed once it has sent everything and got all its
+ * replies, or if the connection fails.
+ */
+static void client_send(Server *s, Client *c)
+{
+    while (c->out_sent < c->out.len) {
+        ssize_t nsent = send(c->fd, c->out.data + c->out_sent, c->out.len - c->out_sent, MSG_NOSIGNAL);
+        if (nsent == -1 && errno == EINTR)  continue;
+        if (nsent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))  break;
+        if (nsent == -1) {
+            client_close(s, c);
+            return;
+        }
+        c->out_sent += nsent;
+    }
+    if (c->out_sent == c->out.len)  c->out.len = c->out_sent = 0;
+
+    if (c->closing && c->out.len == 0)  client_close(s, c);
+    else  client_update(s, c);
+}
+
+/** @brief Registers a client for the events it needs now.
+ *
+ * It waits to send while it has replies pending, and stops reading when it
+ * has too many of them unread or has no more commands.
+ */
+static void client_update(Server *s, Client *c)
+{
+    uint32_t events = 0;
+    if (!c->closing && c->out.len - c->out_sent < SERVER_BATCH_SIZE)  events |= EPOLLIN;
+    if (c->out_sent < c->out.len)  events |= EPOLLOUT;
+    if (events == c->events)  return;
+
+    struct epoll_event ev = { .events = events, .data.ptr = c };
+    epoll_ctl(s->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->events = events;
+}
+
+/** @brief Disconnects a client and frees it. */
+static void client_close(Server *s, Client *c)
+{
+    epoll_ctl(s->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    if (c->prev != NULL)  c->prev->next = c->next;
+    else  s->clients = c->next;
+    if (c->next != NULL)  c->next->prev = c->prev;
+    arena_free(&c->in_arena);
+    arena_free(&c->out_arena);
+    free(c);
+}
+
+/** @brief Makes reads and writes of a file descriptor non-blocking.
+ * @return 0 on success, 1 otherwise
+ */
+static int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+    return flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1;
+}
@@ -0,0 +1,27 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "../../Problem2/src/durable.h"
+
+// Most events handled per wait
+#define SERVER_EVENTS 64
+// Size of the reads from a client
+#define SERVER_READ_SIZE (16*1024)
+// Longest command a client can send. Longer ones are answered with "Not
+// Supported" and skipped, so a client can't make the server hold them.
+#define SERVER_LINE_MAX (16*1024*1024)
+// Results gathered before they are appended to the file, and replies a
+// client can leave unread before the server stops reading its commands
+#define SERVER_BATCH_SIZE (1024*1024)
+
+// What a server did
+typedef struct server_stats {
+    unsigned long long clients;
+    unsigned long long commands;
+    unsigned long long rejected;  // Commands answered with "Not Supported"
+    unsigned long long appends;   // Batches appended to the file
+} ServerStats;
+
+int server_run(const char *path, DurableFile *output, int sigfd, ServerStats *stats);
+
+#endif